@@ -1,92 +1,291 @@
-
 #include "umalloc.h"
-#include "stdio.h" 
+#include "csbrk.h"
+#include "stdio.h"
 
 //Place any variables needed here from umalloc.c as an extern.
-extern memory_block_t *free_head;
+extern arena_t arenas[NUM_ARENAS];
+extern slab_t *partial_slabs[NUM_SLAB_CLASSES];
 
-// Check that all blocks in the free list are marked free.
-int check_free(){
-    memory_block_t *cur = free_head;
+//Regions csbrk handed out, kept by csbrk.c when built with TRACK_CSBRK
+extern region_index sbrk_blocks;
 
-    //loops through the free list
-    while (cur) {
+//What the last failed check_heap found wrong and the block it found it at
+static const char *heap_error;
+static void *heap_error_block;
 
-        //If a block is marked allocated in the free list
-        if (is_allocated(cur)) {
+//records why the heap is inconsistent and returns -1, the checks never print
+static int fail(const char *error, void *block){
+    heap_error = error;
+    heap_error_block = block;
+    return -1;
+}
 
-            //return -1, it is not a valid list
-            printf("not all blocks are free in the list\n");
-            return -1;
+//Region the last pointer followed lies in, links mostly stay inside the region of their block
+static sbrk_block last_region;
+
+//a pointer read from the heap is only followed if length bytes from it lie in one region csbrk still
+//holds, so guard pages and gaps between regions are never read. The region of the last pointer is
+//tried first, the index is only searched when the pointer leaves it
+static bool in_heap(void *ptr, size_t length){
+    uint64_t start = (uint64_t) ptr;
+    if(start < last_region.sbrk_start || start >= last_region.sbrk_end){
+        sbrk_block* region = csbrk_region(ptr);
+        if(region == NULL){
+            return false;
         }
-        cur = cur->next;
+        last_region = *region;
     }
-    return 0;
+    return start + length <= last_region.sbrk_end;
 }
 
-//Checks if all blocks are multiples of 16
-int check_mult(){
-    memory_block_t *cur = free_head;
-
-    //loops through the free list
-    while(cur) {
-
-        //if size is not aligned to 16
-        if (get_size(cur) % ALIGNMENT != 0) {
+//checks that a free block found by the walk can be reached through its links
+static bool in_free_list(memory_block_t *block){
+#ifdef UMALLOC_BEST_FIT
+    //blocks bigger than the small classes live in the tree, they are only counted
+    if(get_size(block) > SMALL_CLASS_LIMIT){
+        return true;
+    }
+#endif
 
-            //return -1, it is not a valid list
-            printf("not all block sizes are multiples of 16\n");
-            return -1;
+    //the first block of a list is its head in one of the arenas
+    if(block->prev == NULL){
+        size_t sizeClass = get_class(get_size(block));
+        for(size_t i = 0; i < NUM_ARENAS; i++){
+            if(arenas[i].free_lists[sizeClass] == block){
+                return true;
+            }
         }
-        cur = cur->next;
+        return false;
+    }
+    return in_heap(block->prev, sizeof(memory_block_t)) && !is_allocated(block->prev) && block->prev->next == block;
+}
+
+/*
+ * check_free_block - checks a free block found through its links without walking the heap:
+ * its header and footer agree and both of its neighbors are allocated and know it is free.
+ * Only the words next to its header and footer are read, the pages in between may have
+ * been given back.
+ */
+static int check_free_block(memory_block_t *block){
+    size_t size = get_size(block);
+    memory_block_t *next = get_next(block);
+    if(size % ALIGNMENT != 0 || size < MIN_BLOCK_SIZE || is_mmapped(block)
+        || !in_heap(next, HEADER_SIZE)){
+        return fail("free block header holds a bad size", block);
+    }
+    if(*get_footer(block) != size){
+        return fail("footer of a free block does not match its header", block);
+    }
+    if(is_prev_free(block)){
+        return fail("free block was not coalesced with the free block before", block);
+    }
+    if(!is_allocated(next)){
+        return fail("free block was not coalesced with the free block after", next);
+    }
+    if(!is_prev_free(next)){
+        return fail("prev free bit does not match the block before", next);
     }
     return 0;
 }
 
-//checks if free list is in memory addresses' ascending order
-int check_ascending(){
-    memory_block_t *cur = free_head;
+/*
+ * walk_region - walks one tracked region block by block in address order, checking that
+ * the blocks cover it without gaps or overlaps, that every header is sane, that the prev
+ * free bits and footers match, that no two free blocks touch and that every free block
+ * sits in a free list. A tracked region may hold several heap regions back to back,
+ * each starting with an alignment pad and ending in an epilogue of size 0.
+ */
+static int walk_region(sbrk_block *region, size_t *numFree){
+    char* regionEnd = (char*) region->sbrk_end;
+    memory_block_t* block = (memory_block_t*) (region->sbrk_start + HEADER_SIZE);
+    bool prevFree = false;
+    while(true){
+        if((char*) block + HEADER_SIZE > regionEnd){
+            return fail("heap region does not end in an epilogue", block);
+        }
+        if(is_prev_free(block) != prevFree){
+            return fail("prev free bit does not match the block before", block);
+        }
+        size_t size = get_size(block);
 
-    //loops through the free list
-    while(cur){
+        //an epilogue ends a heap region, the next one starts right after its header
+        if(size == 0){
+            if(!is_allocated(block)){
+                return fail("epilogue is not marked allocated", block);
+            }
+            if((char*) block + HEADER_SIZE == regionEnd){
+                return 0;
+            }
+            block = (memory_block_t*) ((char*) block + REGION_OVERHEAD);
+            prevFree = false;
+            continue;
+        }
 
-        //checks based on previous node, checking free_head could be an invalid check
-        if(cur != free_head){
+        if(size % ALIGNMENT != 0 || size < MIN_BLOCK_SIZE || is_mmapped(block)){
+            return fail("block header holds a bad size", block);
+        }
+        if((char*) block + size > regionEnd - HEADER_SIZE){
+            return fail("block overlaps the end of its region", block);
+        }
+        if(!is_allocated(block)){
+            if(prevFree){
+                return fail("free block was not coalesced with the free block before", block);
+            }
+            if(*get_footer(block) != size){
+                return fail("footer of a free block does not match its header", block);
+            }
+            if(!in_free_list(block)){
+                return fail("free block is not in a free list", block);
+            }
+            (*numFree)++;
+        }
+        prevFree = !is_allocated(block);
+        block = get_next(block);
+    }
+}
 
-            //checks if previous block's memories are greater than the current block
-            if(cur->prev > cur){
+/*
+ * check_lists - checks the free lists and bitmap of one arena and counts their blocks.
+ * Every block must be free, in the list of its class and linked both ways. A list can
+ * never hold more blocks than the walk found free, so a cycle stops at maxFree.
+ */
+static int check_lists(arena_t *arena, size_t maxFree, size_t *numListed){
+    for(size_t i = 0; i < NUM_CLASSES; i++){
 
-                //if a block is not in the right order, return -1
-                printf("not all blocks are in ascending order\n");
+        //class bit must be set exactly when the list is non-empty
+        if(((arena->free_bitmap >> i) & 0x1) != (arena->free_lists[i] != NULL)){
+            return fail("bitmap bit does not match its class list", arena->free_lists[i]);
+        }
+        memory_block_t *cur = arena->free_lists[i];
+        if(cur && cur->prev != NULL){
+            return fail("head of a class list has a prev block", cur);
+        }
+        while(cur){
+            if(++*numListed > maxFree){
+                return fail("free lists hold more blocks than the heap", cur);
+            }
+            if(!in_heap(cur, sizeof(memory_block_t)) || is_allocated(cur)){
+                return fail("free list holds a block that is not free", cur);
+            }
+            if(check_free_block(cur) != 0){
                 return -1;
             }
+            if(get_class(get_size(cur)) != i){
+                return fail("free block is in the wrong class list", cur);
+            }
+            if(cur->next && (!in_heap(cur->next, sizeof(memory_block_t)) || cur->next->prev != cur)){
+                return fail("free list is not linked both ways", cur);
+            }
+            cur = cur->next;
+        }
+    }
+    return 0;
+}
+
+#ifdef UMALLOC_BEST_FIT
+//checks a subtree is ordered by size within (low, high) and every list hanging off it holds its size
+static int check_tree(memory_block_t *node, size_t low, size_t high, size_t maxFree, size_t *numListed){
+    if(node == NULL){
+        return 0;
+    }
+    if(!in_heap(node, sizeof(memory_block_t))){
+        return fail("tree node is outside the heap", node);
+    }
+    size_t size = get_size(node);
+    if(size <= low || size >= high || size <= SMALL_CLASS_LIMIT || node->prev != NULL){
+        return fail("tree node is out of order", node);
+    }
+    for(memory_block_t *cur = node; cur; cur = cur->next){
+        if(++*numListed > maxFree){
+            return fail("free tree holds more blocks than the heap", cur);
+        }
+        if(!in_heap(cur, sizeof(memory_block_t)) || is_allocated(cur) || get_size(cur) != size){
+            return fail("tree holds a block that is not a free block of its size", cur);
+        }
+        if(check_free_block(cur) != 0){
+            return -1;
+        }
+        if(cur->next && (!in_heap(cur->next, sizeof(memory_block_t)) || cur->next->prev != cur)){
+            return fail("list of a tree node is not linked both ways", cur);
+        }
+    }
+    tree_node_t *links = (tree_node_t*) node;
+    if(check_tree(links->left, low, size, maxFree, numListed) != 0){
+        return -1;
+    }
+    return check_tree(links->right, size, high, maxFree, numListed);
+}
+#endif
+
+//checks the best fit tree, there is none in first fit mode
+static int check_free_tree(arena_t *arena, size_t maxFree, size_t *numListed){
+#ifdef UMALLOC_BEST_FIT
+    return check_tree(arena->free_tree, 0, SIZE_MAX, maxFree, numListed);
+#else
+    return 0;
+#endif
+}
+
+//checks that quick list blocks are still marked allocated and sit in the list of their size
+static int check_quick(arena_t *arena){
+#ifdef UMALLOC_DEFER_COALESCE
+    size_t count = 0;
+    for(size_t i = 0; i < NUM_SMALL_CLASSES; i++){
+        for(memory_block_t *cur = arena->quick_lists[i]; cur; cur = cur->next){
+            if(++count > arena->quick_count){
+                return fail("quick lists hold more blocks than they count", cur);
+            }
+            if(!in_heap(cur, sizeof(memory_block_t)) || !is_allocated(cur) || get_class(get_size(cur)) != i){
+                return fail("quick list block is in the wrong class", cur);
+            }
         }
-        cur = cur->next;
     }
+    if(count != arena->quick_count){
+        return fail("quick lists hold fewer blocks than they count", NULL);
+    }
+#endif
     return 0;
 }
 
-//checks for neighbors that could have been coalesced
-int check_neighbors(){
-    memory_block_t *cur = free_head;
+//checks that every partial slab holds objects of its class and counts its free objects right
+static int check_slabs(){
 
-    //loops through the free list
-    while(cur && cur->next != NULL){
+    //loops through every slab class list
+    for(size_t i = 0; i < NUM_SLAB_CLASSES; i++){
+        slab_t *cur = partial_slabs[i];
+        while(cur){
 
-        //calculates the neighboring address through pointer arithmetic
-        memory_block_t* addressCheck = (memory_block_t*) ((char*) cur + get_size(cur));
+            //a slab in the wrong class hands out objects of the wrong size
+            if(cur->object_size != (i + 1) * ALIGNMENT){
+                return fail("slab is in the wrong class", cur);
+            }
 
-        //checks if the next block in free list is it's neighbor 
-        if(addressCheck == cur->next){
+            //the free count must match the bitmap and a partial slab is never full
+            uint32_t numFree = 0;
+            for(size_t word = 0; word < SLAB_MAP_WORDS; word++){
+                numFree += __builtin_popcountl(cur->free_map[word]);
+            }
+            if(numFree != cur->num_free || numFree == 0){
+                return fail("slab free count does not match its bitmap", cur);
+            }
+            if(cur->next && cur->next->prev != cur){
+                return fail("slabs are not linked both ways", cur);
+            }
+            cur = cur->next;
+        }
+    }
+    return 0;
+}
 
-            //if it is then not all blocks have been coalesced properly, return -1
-            printf("not all neighbors are combined\n");
-            printf("Cur Address: %p, Neighbor Address: %p\n", cur, cur->next);
+//checks the free structures of every arena and the slabs, counting the blocks listed in numListed
+static int check_structures(size_t maxFree, size_t *numListed){
+    for(size_t i = 0; i < NUM_ARENAS; i++){
+        if(check_lists(&arenas[i], maxFree, numListed) != 0 || check_free_tree(&arenas[i], maxFree, numListed) != 0
+            || check_quick(&arenas[i]) != 0){
             return -1;
         }
-        cur = cur->next;
     }
-    return 0;
+    return check_slabs();
 }
 
 /*
@@ -94,15 +293,54 @@ int check_neighbors(){
  * Required to be completed for checkpoint 1.
  * Should return 0 if the heap is still consistent, otherwise return a non-zero
  * return code. Asserts are also a useful tool here.
+ * Only follows the free structures, so its cost grows with the number of free blocks:
+ * every listed block must be free, linked both ways and in the right list, and agree
+ * with its footer and both of its neighbors. A list can never hold more blocks than fit
+ * in the heap, so a cycle stops there. Allocated blocks that are not next to a free one
+ * are never looked at, check_heap_walk does that. Nothing is printed, check_heap_error
+ * says what failed.
  */
 int check_heap() {
-    //if any of these tests do not return zero, it will return -1
-    if(check_free() != 0 || check_mult() != 0 || check_ascending() != 0 || check_neighbors() != 0){
-        printf("Failed tests\n");
+    //regions may have changed since the last check
+    last_region.sbrk_end = 0;
+    size_t heapBytes = 0;
+    for(size_t i = 0; i < sbrk_blocks.count; i++){
+        heapBytes += sbrk_blocks.blocks[i].sbrk_end - sbrk_blocks.blocks[i].sbrk_start;
+    }
+    size_t numListed = 0;
+    return check_structures(heapBytes / MIN_BLOCK_SIZE, &numListed);
+}
+
+/*
+ * check_heap_walk - does what check_heap does after walking every block once in address
+ * order, so its cost grows with the number of blocks in the heap. The walk checks the blocks
+ * cover every region and every header is sane, the lists must then hold exactly as many
+ * blocks as the walk found free.
+ */
+int check_heap_walk() {
+    last_region.sbrk_end = 0;
+    size_t numFree = 0;
+    for(size_t i = 0; i < sbrk_blocks.count; i++){
+        if(walk_region(&sbrk_blocks.blocks[i], &numFree) != 0){
+            return -1;
+        }
+    }
+
+    size_t numListed = 0;
+    if(check_structures(numFree, &numListed) != 0){
         return -1;
     }
-    //else it passes
-    printf("No problems!\n");
+    if(numListed != numFree){
+        return fail("free lists hold fewer blocks than the heap", NULL);
+    }
     return 0;
 }
 
+/*
+ * check_heap_error - Returns what the last failed check_heap found wrong and sets block
+ * to the block it found it at, which may be NULL.
+ */
+const char *check_heap_error(void **block) {
+    *block = heap_error_block;
+    return heap_error;
+}
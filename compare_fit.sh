@@ -0,0 +1,16 @@
+#!/bin/sh
+# Builds first fit and best fit umalloc in turn and prints the utilization from
+# runner -u and the time from performance for every trace under both.
+for fit in first best; do
+  if [ "$fit" = best ]; then flags=-DUMALLOC_BEST_FIT; else flags=; fi
+  make clean > /dev/null
+  make runner performance err_handler.o UMALLOC_FLAGS="$flags" > /dev/null || exit 1
+  echo "$fit fit"
+  for trace in traces/*.rep; do
+    util=$(./runner -ru "$trace" | grep "Final Utilization" | awk '{print $4}')
+    time=$(./performance "$trace" | awk '{print $2}')
+    printf "  %-28s util: %-8s time: %s\n" "$trace" "$util" "$time"
+  done
+done
+make clean > /dev/null
+make > /dev/null
@@ -0,0 +1,20 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ * 
+ * convert_trace.c - Converts a text .rep trace into the binary trace format,
+ * which runner and performance map instead of parsing
+ **************************************************************************/
+
+#include "support.h"
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: convert_trace in.rep out.bin\n");
+        appl_error("Missing file parameters.");
+    }
+    trace_t *trace = read_trace(argv[1], 0);
+    write_trace(trace, argv[2]);
+    printf("Converted %d ops over %d ids\n", trace->num_ops, trace->num_ids);
+    free_trace(trace);
+    return 0;
+}
@@ -9,24 +9,191 @@
  * May not be used, modified, or copied without permission.
  **************************************************************************/
 
+#define _GNU_SOURCE
 #include "csbrk.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <sys/mman.h>
 
-sbrk_block *sbrk_blocks = NULL;
+/* The regions are also indexed, without the byte counts, for the free checks of umalloc */
+#if defined(TRACK_CSBRK) || defined(UMALLOC_CHECK_FREE)
+#define INDEX_CSBRK
+#endif
+
+region_index sbrk_blocks;
 size_t sbrk_bytes;
+size_t released_bytes;
+region_index released_pages;
+region_index mmap_blocks;
+size_t mmap_bytes;
+size_t max_mmap_bytes;
+size_t max_footprint_bytes;
+
+/*
+ * region_position - Returns how many regions of the index start at or below addr,
+ * the region that could hold addr is the one before that position.
+ */
+static size_t region_position(region_index *index, uint64_t addr)
+{
+    size_t low = 0;
+    size_t high = index->count;
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (index->blocks[mid].sbrk_start <= addr)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * region_containing - Returns the region holding addr, or NULL if there is none.
+ */
+static sbrk_block *region_containing(region_index *index, uint64_t addr)
+{
+    size_t pos = region_position(index, addr);
+    if (pos > 0 && addr < index->blocks[pos - 1].sbrk_end)
+    {
+        return &index->blocks[pos - 1];
+    }
+    return NULL;
+}
+
+#ifdef INDEX_CSBRK
+/*
+ * region_insert - Adds the region from start to end to the index. With merge set,
+ * a region ending at start is grown instead, the way growing the break grows the
+ * last region.
+ */
+static void region_insert(region_index *index, uint64_t start, uint64_t end, bool merge)
+{
+    size_t pos = region_position(index, start);
+    if (merge && pos > 0 && index->blocks[pos - 1].sbrk_end == start)
+    {
+        index->blocks[pos - 1].sbrk_end = end;
+        return;
+    }
+
+    if (index->count == index->capacity)
+    {
+        index->capacity = index->capacity ? 2 * index->capacity : 16;
+        index->blocks = realloc(index->blocks, index->capacity * sizeof(sbrk_block));
+        assert(index->blocks != NULL);
+    }
+    for (size_t i = index->count; i > pos; i--)
+    {
+        index->blocks[i] = index->blocks[i - 1];
+    }
+    index->blocks[pos].sbrk_start = start;
+    index->blocks[pos].sbrk_end = end;
+    index->count++;
+}
+
+/*
+ * region_find - Returns the region starting at start, or NULL if there is none.
+ */
+static sbrk_block *region_find(region_index *index, uint64_t start)
+{
+    size_t pos = region_position(index, start);
+    if (pos > 0 && index->blocks[pos - 1].sbrk_start == start)
+    {
+        return &index->blocks[pos - 1];
+    }
+    return NULL;
+}
+
+/*
+ * region_remove - Takes a region returned by region_find out of the index.
+ */
+static void region_remove(region_index *index, sbrk_block *region)
+{
+    size_t pos = region - index->blocks;
+    for (size_t i = pos + 1; i < index->count; i++)
+    {
+        index->blocks[i - 1] = index->blocks[i];
+    }
+    index->count--;
+}
+#endif
+
+#ifdef TRACK_CSBRK
+/*
+ * region_subtract - Takes the range from start to end out of every region of the
+ * index, cutting a region in two if the range lies inside it. Returns how many
+ * bytes of the index it covered.
+ */
+static size_t region_subtract(region_index *index, uint64_t start, uint64_t end)
+{
+    size_t covered = 0;
+    size_t pos = region_position(index, start);
+    if (pos > 0 && index->blocks[pos - 1].sbrk_end > start)
+    {
+        pos--;
+    }
+    while (pos < index->count && index->blocks[pos].sbrk_start < end)
+    {
+        sbrk_block *temp = &index->blocks[pos];
+        uint64_t cut_start = temp->sbrk_start > start ? temp->sbrk_start : start;
+        uint64_t cut_end = temp->sbrk_end < end ? temp->sbrk_end : end;
+        covered += cut_end - cut_start;
+
+        if (temp->sbrk_start < cut_start && cut_end < temp->sbrk_end)
+        {
+            uint64_t old_end = temp->sbrk_end;
+            temp->sbrk_end = cut_start;
+            region_insert(index, cut_end, old_end, false);
+            return covered;
+        }
+        if (temp->sbrk_start < cut_start)
+        {
+            temp->sbrk_end = cut_start;
+            pos++;
+        }
+        else if (cut_end < temp->sbrk_end)
+        {
+            temp->sbrk_start = cut_end;
+            return covered;
+        }
+        else
+        {
+            region_remove(index, temp);
+        }
+    }
+    return covered;
+}
+
+/*
+ * track_footprint - Records the largest number of bytes ever held from sbrk and
+ * mmap at the same time.
+ */
+static void track_footprint()
+{
+    if (sbrk_bytes + mmap_bytes > max_footprint_bytes)
+    {
+        max_footprint_bytes = sbrk_bytes + mmap_bytes;
+    }
+}
+#endif
 
 /*
  * csbrk - A wrapper for sbrk. Places a maximum on the maximum amount of memory
  * that can be requested. If tracking is enabled, keeps track of the sbrk regions
- * allocated for correctness and utilization.
+ * allocated for correctness and utilization. A negative increment gives the top
+ * of the last region back and is counted in released_bytes, apart from the pages
+ * in it cmadvise already counted.
  */
 void *csbrk(intptr_t increment)
 {
-    if (increment > 16 * PAGESIZE)
+    if (increment > CSBRK_LIMIT)
     {
         printf("%ld %d %d\n", increment, 8 * PAGESIZE, increment > 8 * PAGESIZE);
         fprintf(stderr, "Memory request execeeds limit hello\n");
@@ -36,50 +203,217 @@ void *csbrk(intptr_t increment)
     void *ret = sbrk(increment);
 #ifdef TRACK_CSBRK
     sbrk_bytes += increment;
-    uint64_t sbrk_start_temp = (uint64_t)ret;
-    uint64_t sbrk_end_temp = sbrk_start_temp + (uint64_t)increment;
-    bool coalesced = false;
-    sbrk_block *temp = sbrk_blocks;
-    while (temp != NULL)
-    {
-        if (temp->sbrk_end == sbrk_start_temp){
-            temp->sbrk_end = sbrk_end_temp;
-            coalesced = true;
-            break;
+    track_footprint();
+    if (increment < 0)
+    {
+        size_t dropped = region_subtract(&released_pages, (uint64_t)ret + increment, (uint64_t)ret);
+        sbrk_bytes += dropped;
+        released_bytes += -increment - dropped;
+    }
+#endif
+#ifdef INDEX_CSBRK
+    if (increment < 0)
+    {
+        sbrk_block *temp = region_containing(&sbrk_blocks, (uint64_t)ret - 1);
+        if (temp != NULL && temp->sbrk_end == (uint64_t)ret)
+        {
+            temp->sbrk_end += increment;
         }
-        temp = temp->next;
+        return ret;
     }
 
-    if (!coalesced) {
-        sbrk_block *temp = malloc(sizeof(sbrk_block));
-        temp->sbrk_start = sbrk_start_temp;
-        temp->sbrk_end = sbrk_end_temp;
+    region_insert(&sbrk_blocks, (uint64_t)ret, (uint64_t)ret + (uint64_t)increment, true);
+#endif
+
+    return ret;
+}
 
-        temp->next = sbrk_blocks;
-        sbrk_blocks = temp;
+/*
+ * cmmap - A wrapper for a private anonymous mmap of length bytes. If tracking is
+ * enabled, keeps track of the mapped regions for correctness and utilization.
+ * Returns NULL if the mapping fails.
+ */
+void *cmmap(size_t length)
+{
+    void *ret = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ret == MAP_FAILED)
+    {
+        return NULL;
+    }
+#ifdef TRACK_CSBRK
+    mmap_bytes += length;
+    if (mmap_bytes > max_mmap_bytes)
+    {
+        max_mmap_bytes = mmap_bytes;
+    }
+    track_footprint();
+#endif
+#ifdef INDEX_CSBRK
+    region_insert(&mmap_blocks, (uint64_t)ret, (uint64_t)ret + (uint64_t)length, false);
+#endif
+
+    return ret;
+}
+
+/*
+ * cmunmap - A wrapper for munmap of a region returned by cmmap. If tracking is
+ * enabled, forgets the region.
+ */
+int cmunmap(void *addr, size_t length)
+{
+#ifdef INDEX_CSBRK
+    sbrk_block *temp = region_find(&mmap_blocks, (uint64_t)addr);
+    if (temp != NULL)
+    {
+        region_remove(&mmap_blocks, temp);
+#ifdef TRACK_CSBRK
+        mmap_bytes -= length;
+#endif
+    }
+#endif
+
+    return munmap(addr, length);
+}
+
+/*
+ * cmremap - A wrapper for mremap of a region returned by cmmap, the region may
+ * move. If tracking is enabled, updates the tracked region. Returns NULL if the
+ * region cannot be resized.
+ */
+void *cmremap(void *addr, size_t old_length, size_t new_length)
+{
+    void *ret = mremap(addr, old_length, new_length, MREMAP_MAYMOVE);
+    if (ret == MAP_FAILED)
+    {
+        return NULL;
+    }
+#ifdef TRACK_CSBRK
+    mmap_bytes = mmap_bytes - old_length + new_length;
+    if (mmap_bytes > max_mmap_bytes)
+    {
+        max_mmap_bytes = mmap_bytes;
     }
+    track_footprint();
+#endif
+#ifdef INDEX_CSBRK
+    sbrk_block *temp = region_find(&mmap_blocks, (uint64_t)addr);
+    if (temp != NULL)
+    {
+        region_remove(&mmap_blocks, temp);
+        region_insert(&mmap_blocks, (uint64_t)ret, (uint64_t)ret + (uint64_t)new_length, false);
+    }
+#endif
+
+    return ret;
+}
+
+/*
+ * cmadvise - A wrapper for madvise(MADV_DONTNEED) of whole pages inside an sbrk
+ * region, which stay mapped but give their memory back and read as zero again.
+ * If tracking is enabled, takes the pages off the footprint and counts them in
+ * released_bytes until check_malloc_output sees a payload on them again.
+ */
+int cmadvise(void *addr, size_t length)
+{
+#ifdef TRACK_CSBRK
+    uint64_t start = (uint64_t)addr;
+    size_t dropped = region_subtract(&released_pages, start, start + length);
+    region_insert(&released_pages, start, start + length, true);
+    sbrk_bytes -= length - dropped;
+    released_bytes += length - dropped;
 #endif
 
+    return madvise(addr, length, MADV_DONTNEED);
+}
+
+/*
+ * cmreserve - Reserves length bytes of address space without any memory behind
+ * it. Nothing is tracked until parts of it are handed to cmcommit. Returns NULL
+ * if the reservation fails.
+ */
+void *cmreserve(size_t length)
+{
+    void *ret = mmap(NULL, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ret == MAP_FAILED)
+    {
+        return NULL;
+    }
     return ret;
 }
 
+/*
+ * cmcommit - Makes length bytes at addr, inside a region returned by cmreserve,
+ * readable and writable. If tracking is enabled, keeps track of the committed
+ * memory like a mapping from cmmap, growing a tracked region that ends at addr.
+ * Returns -1 if the memory cannot be committed.
+ */
+int cmcommit(void *addr, size_t length)
+{
+    if (mprotect(addr, length, PROT_READ | PROT_WRITE) == -1)
+    {
+        return -1;
+    }
+#ifdef TRACK_CSBRK
+    mmap_bytes += length;
+    if (mmap_bytes > max_mmap_bytes)
+    {
+        max_mmap_bytes = mmap_bytes;
+    }
+    track_footprint();
+#endif
+#ifdef INDEX_CSBRK
+    region_insert(&mmap_blocks, (uint64_t)addr, (uint64_t)addr + (uint64_t)length, true);
+#endif
+
+    return 0;
+}
+
 /*
  * check_malloc_output - Checks that a payload returned by umalloc falls within
- * one of the sbrk regions.
+ * one of the sbrk or mmap regions. Regions of either kind never overlap, so only
+ * the region holding the start of the payload has to be looked at. Pages of the
+ * payload cmadvise released are about to be written and count as held again.
  */
 int check_malloc_output(void *payload_start, size_t payload_length)
 {
     uint64_t start_uint = (uint64_t)payload_start;
     uint64_t end_uint = start_uint + (uint64_t)payload_length;
-    sbrk_block *temp = sbrk_blocks;
-    while (temp != NULL)
+#ifdef TRACK_CSBRK
+    if (released_pages.count > 0)
     {
-        if (start_uint >= temp->sbrk_start && end_uint <= temp->sbrk_end)
-        {
-            return 0;
-        }
-        temp = temp->next;
+        uint64_t page_mask = PAGESIZE - 1;
+        sbrk_bytes += region_subtract(&released_pages, start_uint & ~page_mask, (end_uint + page_mask) & ~page_mask);
+        track_footprint();
+    }
+#endif
+    sbrk_block *temp = region_containing(&sbrk_blocks, start_uint);
+    if (temp == NULL)
+    {
+        temp = region_containing(&mmap_blocks, start_uint);
+    }
+    if (temp != NULL && end_uint <= temp->sbrk_end)
+    {
+        return 0;
     }
 
     return -1;
-}
\ No newline at end of file
+}
+#ifdef INDEX_CSBRK
+/*
+ * csbrk_region - Returns the sbrk region csbrk still holds that addr lies in, or NULL
+ * if there is none. The region may move or change once csbrk is called again.
+ */
+sbrk_block *csbrk_region(void *addr)
+{
+    return region_containing(&sbrk_blocks, (uint64_t)addr);
+}
+
+/*
+ * cmmap_starts - Returns whether one of the mapped regions from cmmap starts at addr,
+ * so the region can be read without touching memory that was unmapped.
+ */
+int cmmap_starts(void *addr)
+{
+    return region_find(&mmap_blocks, (uint64_t)addr) != NULL;
+}
+#endif
@@ -13,13 +13,29 @@
 #include <stdlib.h>
 
 #define PAGESIZE 4096
+#define CSBRK_LIMIT (16 * PAGESIZE) /* Largest increment csbrk accepts */
 
 typedef struct sbrk_block_struct
 {
     uint64_t sbrk_start;
     uint64_t sbrk_end;
-    struct sbrk_block_struct *next;
 } sbrk_block;
 
+/* Tracked regions sorted by start address, found by binary search */
+typedef struct
+{
+    sbrk_block *blocks;
+    size_t count;
+    size_t capacity;
+} region_index;
+
 void *csbrk(intptr_t increment);
-int check_malloc_output(void *payload_start, size_t payload_length);
\ No newline at end of file
+void *cmmap(size_t length);
+int cmunmap(void *addr, size_t length);
+void *cmremap(void *addr, size_t old_length, size_t new_length);
+int cmadvise(void *addr, size_t length);
+void *cmreserve(size_t length);
+int cmcommit(void *addr, size_t length);
+int check_malloc_output(void *payload_start, size_t payload_length);
+sbrk_block *csbrk_region(void *addr);
+int cmmap_starts(void *addr);
\ No newline at end of file
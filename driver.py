@@ -1,6 +1,6 @@
 #! /usr/bin/env python3
 import subprocess
-import statistics
+import json
 import os
 import math
 from tabulate import tabulate
@@ -8,21 +8,13 @@ from tabulate import tabulate
 utilization_target = 60.00
 performance_target = 1400
 
-def get_num_ops(trace_file):
-    f = open(trace_file, "r")
-    num_ops = int(f.readlines()[1])
-    return num_ops
-
 def performance_check(trace_file):
     N = 20
-    total_time = 0
-    num_ops = get_num_ops(trace_file)
-    for i in range(0, N):
-        performance = subprocess.run(["./performance", trace_file], universal_newlines=True, stdout=subprocess.PIPE)
-        if 'Success' not in performance.stdout:
-            return -1
-        total_time += int(performance.stdout.split()[1])
-    return (num_ops / (total_time // N)) * 1000
+    WARMUP = 2
+    performance = subprocess.run(["./performance", "--iterations", str(N), "--warmup", str(WARMUP), trace_file], universal_newlines=True, stdout=subprocess.PIPE)
+    if performance.returncode != 0:
+        return -1
+    return json.loads(performance.stdout)["ops_per_ms"]
 
 def utilization_check(trace_file):
     utilization = subprocess.run(["./runner", '-ru', trace_file], universal_newlines=True, stdout=subprocess.PIPE,stderr=subprocess.PIPE)
@@ -0,0 +1,104 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ * 
+ * heap_dump.c - Walks every block of every tracked csbrk region and writes
+ * them out, to see where the bytes of a poorly utilized heap go.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "csbrk.h"
+#include "heap_dump.h"
+
+//Regions csbrk handed out, kept by csbrk.c when built with TRACK_CSBRK
+extern region_index sbrk_blocks;
+
+//Totals of one walk of the heap
+typedef struct {
+    size_t allocated_blocks;
+    size_t allocated_bytes;
+    size_t free_blocks;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t class_blocks[NUM_CLASSES];
+    size_t class_bytes[NUM_CLASSES];
+} dump_totals_t;
+
+/*
+ * class_bounds - smallest and largest block size of a size class, the mirror of get_class
+ */
+static void class_bounds(size_t sizeClass, size_t *low, size_t *high) {
+    if(sizeClass < NUM_SMALL_CLASSES){
+        *low = sizeClass * ALIGNMENT + 1;
+        *high = (sizeClass + 1) * ALIGNMENT;
+    } else{
+        *low = ((size_t) SMALL_CLASS_LIMIT << (sizeClass - NUM_SMALL_CLASSES)) + 1;
+        *high = (size_t) SMALL_CLASS_LIMIT << (sizeClass - NUM_SMALL_CLASSES + 1);
+    }
+}
+
+/*
+ * dump_region - writes a line per block of one tracked region and adds them to totals.
+ * A tracked region may hold several heap regions back to back, each starting with an
+ * alignment pad and ending in an epilogue of size 0.
+ */
+static void dump_region(FILE *out, size_t regionIndex, sbrk_block *region, dump_totals_t *totals) {
+    char* regionEnd = (char*) region->sbrk_end;
+    memory_block_t* block = (memory_block_t*) (region->sbrk_start + HEADER_SIZE);
+    while((char*) block + HEADER_SIZE <= regionEnd){
+        size_t size = get_size(block);
+
+        //an epilogue ends a heap region, the next one starts right after its header
+        if(size == 0){
+            block = (memory_block_t*) ((char*) block + REGION_OVERHEAD);
+            continue;
+        }
+        bool allocated = is_allocated(block);
+        fprintf(out, "%lu,%lu,%lu,%s\n", regionIndex, (uintptr_t) block - region->sbrk_start, size,
+            allocated ? "allocated" : "free");
+
+        if(allocated){
+            totals->allocated_blocks++;
+            totals->allocated_bytes += size;
+        } else{
+            size_t sizeClass = get_class(size);
+            totals->free_blocks++;
+            totals->free_bytes += size;
+            totals->largest_free = size > totals->largest_free ? size : totals->largest_free;
+            totals->class_blocks[sizeClass]++;
+            totals->class_bytes[sizeClass] += size;
+        }
+        block = get_next(block);
+    }
+}
+
+/*
+ * dump_heap - writes every block of the heap to filename as CSV lines of region, offset
+ * in the region, size and state, then prints the free block sizes per size class and the
+ * external fragmentation, 1 - largest free block / free bytes, to summary.
+ * Returns -1 if the file cannot be written.
+ */
+int dump_heap(char *filename, FILE *summary) {
+    FILE* out = fopen(filename, "w");
+    if(out == NULL){
+        return -1;
+    }
+    dump_totals_t totals = {0};
+    fprintf(out, "region,offset,size,state\n");
+    for(size_t i = 0; i < sbrk_blocks.count; i++){
+        dump_region(out, i, &sbrk_blocks.blocks[i], &totals);
+    }
+    fclose(out);
+
+    fprintf(summary, "Heap dump %s: %lu regions, %lu allocated blocks (%lu bytes), %lu free blocks (%lu bytes)\n",
+        filename, sbrk_blocks.count, totals.allocated_blocks, totals.allocated_bytes, totals.free_blocks, totals.free_bytes);
+    fprintf(summary, "Largest free block: %lu bytes, external fragmentation: %.2f\n", totals.largest_free,
+        totals.free_bytes ? 1.0 - (double) totals.largest_free / totals.free_bytes : 0);
+    for(size_t i = 0; i < NUM_CLASSES; i++){
+        if(totals.class_blocks[i] != 0){
+            size_t low, high;
+            class_bounds(i, &low, &high);
+            fprintf(summary, "  free %lu-%lu: %lu blocks, %lu bytes\n", low, high, totals.class_blocks[i], totals.class_bytes[i]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,2 @@
+#include <stdio.h>
+int dump_heap(char *filename, FILE *summary);
\ No newline at end of file
@@ -8,38 +8,484 @@
  **************************************************************************/
 
 #include "umalloc.h"
+#include "uarena.h"
 #include "support.h"
+#include <getopt.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define ARENA_ROUNDS 10 /* Times the allocation stream is replayed in arena mode */
+#define HIST_SUB_BITS 4 /* Log2 of the linear sub-buckets per power of two, bounding bucket error to 1/16 */
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS) /* Enough buckets for any 64 bit tick count */
+#define NUM_OUTLIERS 10 /* Slowest ops reported with their trace lines in latency mode */
+
+/* Log-linear histogram of op times in ticks, exact below HIST_SUB_BUCKETS ticks */
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} histogram_t;
+
+/* One of the slowest ops of a latency run */
+typedef struct {
+    uint64_t ticks;
+    size_t op;
+} outlier_t;
+
+/*
+ * replay - Runs count requests of a trace once, first_op being the position of the
+ * first of them in the whole trace.
+ */
+static void replay(traceop_t *ops, size_t count, allocated_block_t *blocks, size_t first_op) {
+    for(size_t i = 0; i < count; i++) {
+        if ((first_op + i) % 5 == 0) {
+            sbrk(4096);
+        }
+        traceop_t op = ops[i];
+        if (op.type == ALLOC) {
+            blocks[op.index].payload = umalloc(op.size);
+        } else if (op.type == CALLOC) {
+            blocks[op.index].payload = ucalloc(1, op.size);
+        } else if (op.type == REALLOC) {
+            blocks[op.index].payload = urealloc(blocks[op.index].payload, op.size);
+        } else {
+            ufree(blocks[op.index].payload);
+        }
+    }
+}
 
 static void run_trace(trace_t *trace) {
 
     struct timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
     uinit();
-    for(size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+    replay(trace->ops, trace->num_ops, trace->blocks, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t delta_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+    printf("Success: %ld", delta_us);
+}
+
+/*
+ * elapsed_us - Microseconds from start to end.
+ */
+static uint64_t elapsed_us(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * elapsed_ns - Nanoseconds from start to end.
+ */
+static uint64_t elapsed_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000 + (end->tv_nsec - start->tv_nsec);
+}
+
+/*
+ * compare_times - qsort order of run times, shortest first.
+ */
+static int compare_times(const void *a, const void *b) {
+    uint64_t time_a = *(const uint64_t *) a;
+    uint64_t time_b = *(const uint64_t *) b;
+    return (time_a > time_b) - (time_a < time_b);
+}
+
+/*
+ * free_live - Frees the blocks a replay of the trace left allocated, which
+ * unbalanced traces do, so the next replay starts from an empty heap. live
+ * has room for a flag per id. Every payload goes back to NULL, a trace may
+ * realloc an id before allocating it.
+ */
+static void free_live(trace_t *trace, bool *live) {
+    memset(live, 0, trace->num_ids * sizeof(bool));
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        live[trace->ops[curr_op].index] = trace->ops[curr_op].type != FREE;
+    }
+    for (size_t id = 0; id < trace->num_ids; id++) {
+        if (live[id]) {
+            ufree(trace->blocks[id].payload);
+        }
+        trace->blocks[id].payload = NULL;
+    }
+}
+
+/*
+ * read_ticks - Reads the cycle counter where there is one, else a nanosecond clock.
+ */
+static inline uint64_t read_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/*
+ * hist_bucket - Index of the histogram bucket counting a time of ticks. Below
+ * HIST_SUB_BUCKETS every value has its own bucket, above that every power of two
+ * is split in HIST_SUB_BUCKETS equal buckets.
+ */
+static size_t hist_bucket(uint64_t ticks) {
+    if (ticks < HIST_SUB_BUCKETS) {
+        return ticks;
+    }
+    int exponent = 63 - __builtin_clzl(ticks);
+    return (exponent - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + ((ticks >> (exponent - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+/*
+ * hist_value - Smallest time counted by a histogram bucket.
+ */
+static uint64_t hist_value(size_t bucket) {
+    if (bucket < HIST_SUB_BUCKETS) {
+        return bucket;
+    }
+    int exponent = bucket / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+    return (uint64_t) (HIST_SUB_BUCKETS + bucket % HIST_SUB_BUCKETS) << (exponent - HIST_SUB_BITS);
+}
+
+/*
+ * hist_percentile - Smallest bucket value at or below which percent of the times fall.
+ */
+static uint64_t hist_percentile(histogram_t *hist, double percent) {
+    uint64_t rank = (uint64_t) (hist->total * percent / 100);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+        seen += hist->counts[bucket];
+        if (seen > rank) {
+            return hist_value(bucket);
+        }
+    }
+    return hist->max;
+}
+
+/*
+ * record_outlier - Keeps op among the NUM_OUTLIERS slowest ops seen so far,
+ * which are sorted slowest first.
+ */
+static void record_outlier(outlier_t *outliers, uint64_t ticks, size_t op) {
+    if (ticks <= outliers[NUM_OUTLIERS - 1].ticks) {
+        return;
+    }
+    int i = NUM_OUTLIERS - 1;
+    while (i > 0 && outliers[i - 1].ticks < ticks) {
+        outliers[i] = outliers[i - 1];
+        i--;
+    }
+    outliers[i].ticks = ticks;
+    outliers[i].op = op;
+}
+
+/*
+ * tick_overhead - The cost of reading the cycle counter, taken off every op time.
+ */
+static uint64_t tick_overhead(void) {
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t before = read_ticks();
+        uint64_t after = read_ticks();
+        overhead = after - before < overhead ? after - before : overhead;
+    }
+    return overhead;
+}
+
+/*
+ * replay_timed - Runs every request of the trace once like replay, timing each op
+ * on its own with the cycle counter. Times go to the histogram of their kind of
+ * request in hists, and to outliers unless it is NULL.
+ */
+static void replay_timed(trace_t *trace, histogram_t *hists, outlier_t *outliers, uint64_t overhead) {
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
         if (curr_op % 5 == 0) {
             sbrk(4096);
         }
         traceop_t op = trace->ops[curr_op];
+        uint64_t before = read_ticks();
         if (op.type == ALLOC) {
             trace->blocks[op.index].payload = umalloc(op.size);
+        } else if (op.type == CALLOC) {
+            trace->blocks[op.index].payload = ucalloc(1, op.size);
+        } else if (op.type == REALLOC) {
+            trace->blocks[op.index].payload = urealloc(trace->blocks[op.index].payload, op.size);
         } else {
             ufree(trace->blocks[op.index].payload);
         }
+        uint64_t ticks = read_ticks() - before;
+        ticks = ticks > overhead ? ticks - overhead : 0;
+
+        histogram_t *hist = &hists[op.type];
+        hist->counts[hist_bucket(ticks)]++;
+        hist->total++;
+        hist->max = ticks > hist->max ? ticks : hist->max;
+        if (outliers != NULL) {
+            record_outlier(outliers, ticks, curr_op);
+        }
     }
+}
+
+/*
+ * run_latency - Replays the trace timing every op on its own with the cycle counter.
+ * Times go to one histogram per kind of request, printed as percentiles in ns, and
+ * the slowest ops are printed with their trace lines. The cost of reading the
+ * counter is measured first and taken off every time.
+ */
+static void run_latency(trace_t *trace) {
+    static const char *names[] = {"umalloc", "ufree", "urealloc", "ucalloc"};
+    histogram_t *hists = calloc(4, sizeof(histogram_t));
+    outlier_t outliers[NUM_OUTLIERS] = {{0}};
+    struct timespec start, end;
+    if (hists == NULL)
+        appl_error("Failed to allocate histograms");
+    uint64_t overhead = tick_overhead();
+
+    uinit();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t first_tick = read_ticks();
+    replay_timed(trace, hists, outliers, overhead);
+    uint64_t last_tick = read_ticks();
     clock_gettime(CLOCK_MONOTONIC, &end);
-    uint64_t delta_us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
-    printf("Success: %ld", delta_us);
+
+    //the counter runs at its own rate, the clock tells how many ns a tick is
+    double ns_per_tick = (double) elapsed_ns(&start, &end) / (last_tick - first_tick ? last_tick - first_tick : 1);
+    for (int type = ALLOC; type <= CALLOC; type++) {
+        histogram_t *hist = &hists[type];
+        if (hist->total == 0) {
+            continue;
+        }
+        printf("%-8s ops: %-8lu p50: %-8.0f p90: %-8.0f p99: %-8.0f p99.9: %-8.0f max: %.0f ns\n", names[type], hist->total,
+            hist_percentile(hist, 50) * ns_per_tick, hist_percentile(hist, 90) * ns_per_tick,
+            hist_percentile(hist, 99) * ns_per_tick, hist_percentile(hist, 99.9) * ns_per_tick, hist->max * ns_per_tick);
+    }
+    printf("Slowest ops:\n");
+    for (int i = 0; i < NUM_OUTLIERS && outliers[i].ticks != 0; i++) {
+        traceop_t op = trace->ops[outliers[i].op];
+        if (op.type == FREE) {
+            printf("  line %lu: %s id %d: %.0f ns\n", LINENUM(outliers[i].op), names[op.type], op.index, outliers[i].ticks * ns_per_tick);
+        } else {
+            printf("  line %lu: %s id %d, %d bytes: %.0f ns\n", LINENUM(outliers[i].op), names[op.type], op.index, op.size,
+                outliers[i].ticks * ns_per_tick);
+        }
+    }
+    free(hists);
+}
+
+/*
+ * run_iterations - Replays the trace warmup + iterations times in this process
+ * and prints the mean time per op of the fastest and the median timed replay,
+ * and ops/ms at the median, as JSON. Then it replays the trace iterations more
+ * times timing every op on its own, which would slow the timed replays down,
+ * and adds the min, median, p99 and max time of a single op over all of them.
+ * Before every replay the break goes back to where it was at the start and uinit
+ * builds a new heap, neither of which is timed. malloc may move the break too,
+ * so nothing in the loop may call it.
+ */
+static void run_iterations(trace_t *trace, char *filename, int iterations, int warmup) {
+    struct timespec start, end;
+    uint64_t *times = calloc(iterations, sizeof(uint64_t));
+    bool *live = calloc(trace->num_ids + 1, sizeof(bool));
+    histogram_t *hists = calloc(5, sizeof(histogram_t));
+    if (times == NULL || live == NULL || hists == NULL)
+        appl_error("Failed to allocate time array");
+    uint64_t overhead = tick_overhead();
+    void *heap_base = sbrk(0);
+
+    for (int i = 0; i < warmup + iterations; i++) {
+        if (brk(heap_base) == -1 || uinit() == -1)
+            appl_error("Failed to reset the heap.");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        replay(trace->ops, trace->num_ops, trace->blocks, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (i >= warmup) {
+            times[i - warmup] = elapsed_ns(&start, &end);
+        }
+        free_live(trace, live);
+    }
+
+    //the counter runs at its own rate, the clock over all op replays tells how many ns a tick is
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t first_tick = read_ticks();
+    for (int i = 0; i < iterations; i++) {
+        if (brk(heap_base) == -1 || uinit() == -1)
+            appl_error("Failed to reset the heap.");
+        replay_timed(trace, hists, NULL, overhead);
+        free_live(trace, live);
+    }
+    uint64_t last_tick = read_ticks();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns_per_tick = (double) elapsed_ns(&start, &end) / (last_tick - first_tick ? last_tick - first_tick : 1);
+
+    //the last histogram gathers every kind of request
+    histogram_t *ops = &hists[4];
+    for (int type = ALLOC; type <= CALLOC; type++) {
+        for (size_t bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+            ops->counts[bucket] += hists[type].counts[bucket];
+        }
+        ops->total += hists[type].total;
+        ops->max = hists[type].max > ops->max ? hists[type].max : ops->max;
+    }
+
+    qsort(times, iterations, sizeof(uint64_t), compare_times);
+    double num_ops = trace->num_ops ? trace->num_ops : 1;
+    uint64_t median = iterations % 2 ? times[iterations / 2] : (times[iterations / 2 - 1] + times[iterations / 2]) / 2;
+    printf("{\"trace\": \"%s\", \"ops\": %d, \"iterations\": %d, \"warmup\": %d, "
+        "\"min_iter_ns_per_op\": %.2f, \"median_iter_ns_per_op\": %.2f, \"ops_per_ms\": %.2f, "
+        "\"op_min_ns\": %.0f, \"op_median_ns\": %.0f, \"op_p99_ns\": %.0f, \"op_max_ns\": %.0f}\n",
+        filename, trace->num_ops, iterations, warmup, times[0] / num_ops, median / num_ops,
+        median ? trace->num_ops * 1e6 / median : 0, hist_percentile(ops, 0) * ns_per_tick,
+        hist_percentile(ops, 50) * ns_per_tick, hist_percentile(ops, 99) * ns_per_tick, ops->max * ns_per_tick);
+    free(times);
+    free(live);
+    free(hists);
+}
+
+/*
+ * run_arena - Compares a bump pointer arena against umalloc on the allocation
+ * stream of the trace. Every round allocates each block of the trace in order and
+ * then drops them all, with ufree for umalloc and a single uarena_reset for the arena.
+ * Frees and reallocs of the trace are ignored, only the sizes allocated matter.
+ */
+static void run_arena(trace_t *trace) {
+    struct timespec start, end;
+    void **payloads = calloc(trace->num_ops, sizeof(void *));
+    if (payloads == NULL)
+        appl_error("Failed to allocate payload array");
+    uinit();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < ARENA_ROUNDS; round++) {
+        size_t num_allocs = 0;
+        for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+            traceop_t op = trace->ops[curr_op];
+            if (op.type == ALLOC || op.type == CALLOC) {
+                if ((payloads[num_allocs++] = umalloc(op.size)) == NULL) {
+                    malloc_error(curr_op, "umalloc failed.");
+                    exit(1);
+                }
+            }
+        }
+        for (size_t i = 0; i < num_allocs; i++) {
+            ufree(payloads[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t umalloc_us = elapsed_us(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uarena_t *arena = uarena_create();
+    for (int round = 0; round < ARENA_ROUNDS; round++) {
+        for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+            traceop_t op = trace->ops[curr_op];
+            if (op.type == ALLOC || op.type == CALLOC) {
+                if (uarena_alloc(arena, op.size) == NULL) {
+                    malloc_error(curr_op, "uarena_alloc failed.");
+                    exit(1);
+                }
+            }
+        }
+        uarena_reset(arena);
+    }
+    uarena_destroy(arena);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t arena_us = elapsed_us(&start, &end);
+
+    printf("Umalloc: %ld Arena: %ld", umalloc_us, arena_us);
+    free(payloads);
 }
 
+/*
+ * run_stream - Replays a trace chunk by chunk as a background thread reads it, for
+ * traces too large to hold in memory. Only the replay of each chunk is timed, waiting
+ * for the reader is not.
+ */
+static void run_stream(char *filename) {
+    struct timespec start, end;
+    trace_stream_t *stream = open_trace_stream(filename, 0);
+    trace_t *trace = &stream->trace;
+    uint64_t delta_us = 0;
+    size_t curr_op = 0;
+    traceop_t *ops;
+    int count;
 
+    uinit();
+    while ((ops = next_trace_chunk(stream, &count)) != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        replay(ops, count, trace->blocks, curr_op);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        curr_op += count;
+        delta_us += elapsed_us(&start, &end);
+    }
+    printf("Success: %ld", delta_us);
+    close_trace_stream(stream);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void) {
+    fprintf(stderr, "Usage: performance [-a | -l | -s | --iterations N [--warmup K]] file\n");
+    fprintf(stderr, "  -a              compare a bump pointer arena against umalloc\n");
+    fprintf(stderr, "  -l              time every op and print latency percentiles and the slowest ops\n");
+    fprintf(stderr, "  -s              stream the trace in chunks instead of reading it whole\n");
+    fprintf(stderr, "  --iterations N  replay the trace N times and print per-op times and latency percentiles as JSON\n");
+    fprintf(stderr, "  --warmup K      untimed replays before the N timed ones\n");
+}
 
 int main(int argc, char **argv) { 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: performance file\n");
+    static struct option long_options[] = {
+        {"iterations", required_argument, NULL, 'i'},
+        {"warmup", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0}
+    };
+    bool arena = false;
+    bool latency = false;
+    bool stream = false;
+    int iterations = 0;
+    int warmup = 0;
+    int c;
+    while ((c = getopt_long(argc, argv, "als", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'a':
+            arena = true;
+            break;
+        case 'l':
+            latency = true;
+            break;
+        case 's':
+            stream = true;
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 1 || arena + latency + stream + (iterations > 0) > 1 || iterations < 0 || warmup < 0) {
+        usage();
         appl_error("No File parameter provided.");
     }
-    trace_t *trace = read_trace(argv[1], 0);
-    run_trace(trace);
+    char *filename = argv[optind];
+
+    if (stream) {
+        run_stream(filename);
+        return 0;
+    }
+    trace_t *trace = read_trace(filename, 0);
+    if (arena) {
+        run_arena(trace);
+    } else if (latency) {
+        run_latency(trace);
+    } else if (iterations > 0) {
+        run_iterations(trace, filename, iterations, warmup);
+    } else {
+        run_trace(trace);
+    }
     free_trace(trace);
     return 0;
-}
\ No newline at end of file
+}
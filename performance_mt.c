@@ -0,0 +1,275 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * performance_mt.c - Runs a trace on 1, 2, 4, ... up to N threads at once and evaluates
+ * the thread safe umalloc package (built with -DUMALLOC_THREADS) for throughput.
+ * With -p two threads replay the trace and free each other's blocks instead.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "support.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define DEFAULT_MAX_THREADS 16
+
+/* Shared state of one timed run */
+typedef struct {
+    trace_t *trace;
+    pthread_barrier_t start;
+} run_t;
+
+/* What a single worker thread replays the trace into, and when it ran */
+typedef struct {
+    run_t *run;
+    allocated_block_t *blocks;
+    struct timespec start, end;
+} worker_t;
+
+/*
+ * replay_trace - Waits for every thread to be ready, then replays the trace
+ * into the worker's own block array.
+ */
+static void *replay_trace(void *arg) {
+    worker_t *worker = arg;
+    trace_t *trace = worker->run->trace;
+
+    pthread_barrier_wait(&worker->run->start);
+    clock_gettime(CLOCK_MONOTONIC, &worker->start);
+    for(size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        traceop_t op = trace->ops[curr_op];
+        allocated_block_t *block = &worker->blocks[op.index];
+        if (op.type == ALLOC || op.type == CALLOC) {
+            block->payload = op.type == ALLOC ? umalloc(op.size) : ucalloc(1, op.size);
+            if (block->payload == NULL) {
+                malloc_error(curr_op, "umalloc failed.");
+                exit(1);
+            }
+            block->is_allocated = true;
+        } else if (op.type == REALLOC) {
+            block->payload = urealloc(block->payload, op.size);
+            if (block->payload == NULL) {
+                malloc_error(curr_op, "urealloc failed.");
+                exit(1);
+            }
+            block->is_allocated = true;
+        } else {
+            ufree(block->payload);
+            block->is_allocated = false;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &worker->end);
+    return NULL;
+}
+
+/*
+ * elapsed_us - Microseconds from start to end.
+ */
+static int64_t elapsed_us(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * run_threads - Replays the trace on num_threads threads at once and returns
+ * the microseconds from the first thread starting to the last one finishing.
+ * Blocks a trace leaves allocated are freed afterwards by the main thread, so
+ * they are freed by a thread that did not allocate them.
+ */
+static uint64_t run_threads(trace_t *trace, int num_threads) {
+    run_t run = { .trace = trace };
+    pthread_t threads[num_threads];
+    worker_t workers[num_threads];
+
+    pthread_barrier_init(&run.start, NULL, num_threads + 1);
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].run = &run;
+        workers[i].blocks = calloc(trace->num_ids, sizeof(allocated_block_t));
+        if (workers[i].blocks == NULL)
+            appl_error("Failed to allocate block array");
+        if (pthread_create(&threads[i], NULL, replay_trace, &workers[i]) != 0)
+            appl_error("Failed to create thread");
+    }
+
+    pthread_barrier_wait(&run.start);
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    struct timespec *start = &workers[0].start, *end = &workers[0].end;
+    for (int i = 0; i < num_threads; i++) {
+        if (elapsed_us(&workers[i].start, start) > 0)
+            start = &workers[i].start;
+        if (elapsed_us(end, &workers[i].end) > 0)
+            end = &workers[i].end;
+
+        for (size_t id = 0; id < trace->num_ids; id++) {
+            if (workers[i].blocks[id].is_allocated) {
+                ufree(workers[i].blocks[id].payload);
+            }
+        }
+        free(workers[i].blocks);
+    }
+    pthread_barrier_destroy(&run.start);
+
+    return elapsed_us(start, end);
+}
+
+/* Single producer single consumer queue of payloads, big enough to never fill up */
+typedef struct {
+    void **slots;
+    size_t mask;
+    size_t head, tail;
+} ring_t;
+
+/* One side of a ping-pong run */
+typedef struct {
+    run_t *run;
+    allocated_block_t *blocks;
+    ring_t *to_peer, *from_peer;
+    bool done, *peer_done;
+    struct timespec start, end;
+} player_t;
+
+/*
+ * ring_push - Hands a payload to the thread on the other end of the ring.
+ */
+static void ring_push(ring_t *ring, void *payload) {
+    ring->slots[ring->tail & ring->mask] = payload;
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * ring_free_all - Frees every payload the other thread has handed over so far.
+ */
+static void ring_free_all(ring_t *ring) {
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    while (ring->head != tail) {
+        ufree(ring->slots[ring->head++ & ring->mask]);
+    }
+}
+
+/*
+ * play_ping_pong - Replays the trace like replay_trace, but every free of the trace hands
+ * the block to the other thread, and the blocks the other thread hands over are freed here.
+ */
+static void *play_ping_pong(void *arg) {
+    player_t *player = arg;
+    trace_t *trace = player->run->trace;
+
+    pthread_barrier_wait(&player->run->start);
+    clock_gettime(CLOCK_MONOTONIC, &player->start);
+    for(size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        traceop_t op = trace->ops[curr_op];
+        allocated_block_t *block = &player->blocks[op.index];
+        if (op.type == ALLOC || op.type == CALLOC || op.type == REALLOC) {
+            if (op.type == ALLOC)
+                block->payload = umalloc(op.size);
+            else if (op.type == CALLOC)
+                block->payload = ucalloc(1, op.size);
+            else
+                block->payload = urealloc(block->payload, op.size);
+            if (block->payload == NULL) {
+                malloc_error(curr_op, "umalloc failed.");
+                exit(1);
+            }
+            block->is_allocated = true;
+        } else {
+            ring_push(player->to_peer, block->payload);
+            block->is_allocated = false;
+            ring_free_all(player->from_peer);
+        }
+    }
+
+    //keeps freeing what the other thread hands over until it is done too
+    __atomic_store_n(&player->done, true, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(player->peer_done, __ATOMIC_ACQUIRE)) {
+        ring_free_all(player->from_peer);
+        sched_yield();
+    }
+    ring_free_all(player->from_peer);
+    clock_gettime(CLOCK_MONOTONIC, &player->end);
+    return NULL;
+}
+
+/*
+ * run_ping_pong - Replays the trace on two threads that free each other's blocks and returns
+ * the microseconds from the first thread starting to the last one finishing.
+ */
+static uint64_t run_ping_pong(trace_t *trace) {
+    run_t run = { .trace = trace };
+    pthread_t threads[2];
+    player_t players[2];
+    ring_t rings[2];
+
+    size_t capacity = 1;
+    while (capacity < trace->num_ops)
+        capacity *= 2;
+    for (int i = 0; i < 2; i++) {
+        rings[i] = (ring_t) { .slots = malloc(capacity * sizeof(void *)), .mask = capacity - 1 };
+        players[i] = (player_t) { .run = &run, .blocks = calloc(trace->num_ids, sizeof(allocated_block_t)) };
+        if (rings[i].slots == NULL || players[i].blocks == NULL)
+            appl_error("Failed to allocate ping-pong state");
+    }
+    for (int i = 0; i < 2; i++) {
+        players[i].to_peer = &rings[1 - i];
+        players[i].from_peer = &rings[i];
+        players[i].peer_done = &players[1 - i].done;
+    }
+
+    pthread_barrier_init(&run.start, NULL, 3);
+    for (int i = 0; i < 2; i++) {
+        if (pthread_create(&threads[i], NULL, play_ping_pong, &players[i]) != 0)
+            appl_error("Failed to create thread");
+    }
+    pthread_barrier_wait(&run.start);
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    struct timespec *start = elapsed_us(&players[1].start, &players[0].start) > 0 ? &players[1].start : &players[0].start;
+    struct timespec *end = elapsed_us(&players[0].end, &players[1].end) > 0 ? &players[1].end : &players[0].end;
+    for (int i = 0; i < 2; i++) {
+        for (size_t id = 0; id < trace->num_ids; id++) {
+            if (players[i].blocks[id].is_allocated) {
+                ufree(players[i].blocks[id].payload);
+            }
+        }
+        free(players[i].blocks);
+        free(rings[i].slots);
+    }
+    pthread_barrier_destroy(&run.start);
+
+    return elapsed_us(start, end);
+}
+
+int main(int argc, char **argv) {
+    bool ping_pong = argc > 1 && strcmp(argv[1], "-p") == 0;
+    if (argc < 2 + ping_pong) {
+        fprintf(stderr, "Usage: performance_mt file [max threads]\n");
+        fprintf(stderr, "       performance_mt -p file\n");
+        appl_error("No File parameter provided.");
+    }
+    int max_threads = !ping_pong && argc > 2 ? atoi(argv[2]) : DEFAULT_MAX_THREADS;
+    if (max_threads < 1) {
+        appl_error("Thread count must be at least 1.");
+    }
+
+    trace_t *trace = read_trace(argv[1 + ping_pong], 0);
+    if (uinit() == -1) {
+        appl_error("uinit failed.");
+    }
+    if (ping_pong) {
+        uint64_t delta_us = run_ping_pong(trace);
+        double ops_per_ms = (double) trace->num_ops * 2 * 1000 / (delta_us ? delta_us : 1);
+        printf("Ping-pong Time: %ld Ops/ms: %.2f\n", delta_us, ops_per_ms);
+        free_trace(trace);
+        return 0;
+    }
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        uint64_t delta_us = run_threads(trace, num_threads);
+        double ops_per_ms = (double) trace->num_ops * num_threads * 1000 / (delta_us ? delta_us : 1);
+        printf("Threads: %d Time: %ld Ops/ms: %.2f\n", num_threads, delta_us, ops_per_ms);
+    }
+    free_trace(trace);
+    return 0;
+}
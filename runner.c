@@ -11,11 +11,20 @@
 #include "csbrk.h"
 #include "support.h"
 #include "check_heap.h"
+#include "heap_dump.h"
 #include <sys/mman.h>
 
 int verbose = 0;
+size_t full_check_every = 0; /* ops between full correctness sweeps, 0 sweeps only at the end */
+size_t walk_heap_every = 0; /* ops between heap checks that walk every block, 0 for none */
+size_t *dump_lines = NULL; /* trace lines to dump the heap after, in increasing order */
+size_t num_dump_lines = 0;
+size_t next_dump_line = 0;
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 extern size_t sbrk_bytes;
+extern size_t mmap_bytes;
+extern size_t released_bytes;
+extern size_t max_footprint_bytes;
 extern const char author[];
 
 /* 
@@ -23,13 +32,17 @@ extern const char author[];
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-rhvuc] file\n");
+    fprintf(stderr, "Usage: mdriver [-rhvucs] [-k n] [-f n] [-d lines] file\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-r         Run the trace to completion (bypass interface).\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-v         Print additional debug info.\n");
     fprintf(stderr, "\t-u         Display heap utilization.\n");
-    fprintf(stderr, "\t-c         Runs the user provided heap check after every op.\n");
+    fprintf(stderr, "\t-c         Runs the user provided heap check of the free blocks after every op.\n");
+    fprintf(stderr, "\t-k n       Also walks every block every n ops, which costs time in the number of blocks.\n");
+    fprintf(stderr, "\t-s         Streams the trace in chunks instead of reading it whole (with -r).\n");
+    fprintf(stderr, "\t-f n       Checks every allocated block every n ops, not only the neighbors of each op.\n");
+    fprintf(stderr, "\t-d lines   Dumps every heap block to heap_<line>.csv after each of the comma separated lines,\n\t           lines past the end dump the final heap.\n");
 }
 
 /* 
@@ -57,10 +70,24 @@ static int check_id(size_t *block, size_t block_size, size_t id) {
     return 0;
 }
 
+/* 
+ * check_zero - Checks every byte of a block returned by ucalloc is zero.
+ */
+static int check_zero(char *block, size_t block_size) {
+    for(size_t i = 0; i < block_size; i++) {
+        if (block[i] != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /* 
  * check_correctness - Checks if every block that is mark allocated has the 
  * correct id written out. If this fails, means that an allocated payload
- * was affected by the umalloc package. 
+ * was affected by the umalloc package. Every op checks the blocks next to
+ * the one it touched, this full sweep runs every full_check_every ops and
+ * at the end of the trace.
  */
 static int check_correctness(trace_t *trace, size_t curr_op) {
     for (size_t block_id = 0; block_id < trace->num_ids; block_id++) {
@@ -81,6 +108,127 @@ static int check_correctness(trace_t *trace, size_t curr_op) {
     return 0;
 }
 
+/* 
+ * Ids of the allocated blocks, sorted by payload address, so the blocks
+ * physically next to a block umalloc just touched are found by binary search.
+ */
+size_t *live_ids;
+size_t num_live;
+
+/* 
+ * init_live_index - Makes room for every id of the trace in the live index.
+ */
+static void init_live_index(trace_t *trace) {
+    live_ids = malloc(trace->num_ids * sizeof(size_t));
+    if (live_ids == NULL && trace->num_ids != 0) {
+        appl_error("Failed to allocate live block index");
+    }
+    num_live = 0;
+}
+
+/* 
+ * live_position - Returns the index of the first allocated block whose payload
+ * is not below payload.
+ */
+static size_t live_position(trace_t *trace, void *payload) {
+    size_t low = 0;
+    size_t high = num_live;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if ((char *) trace->blocks[live_ids[mid]].payload < (char *) payload) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* 
+ * check_live - Checks the allocated block at position pos of the live index
+ * still holds its id, positions outside the index are skipped.
+ */
+static int check_live(trace_t *trace, size_t pos, size_t curr_op) {
+    if (pos >= num_live) {
+        return 0;
+    }
+    size_t block_id = live_ids[pos];
+    allocated_block_t *block = &trace->blocks[block_id];
+    if (check_id(block->payload, block->block_size, block->content_val) == -1) {
+        sprintf(msg, "umalloc corrupted block id %lu : Corrupted Memory Address: %p\n", block_id, block);
+        malloc_error(curr_op, msg);
+        return -1;
+    }
+    return 0;
+}
+
+/* 
+ * live_insert - Adds a block that was just handed out to the live index, checks
+ * it does not overlap the blocks on either side and that they are intact.
+ */
+static int live_insert(trace_t *trace, size_t block_id, size_t curr_op) {
+    allocated_block_t *block = &trace->blocks[block_id];
+    size_t pos = live_position(trace, block->payload);
+    allocated_block_t *prev = pos > 0 ? &trace->blocks[live_ids[pos - 1]] : NULL;
+    allocated_block_t *next = pos < num_live ? &trace->blocks[live_ids[pos]] : NULL;
+    if ((prev != NULL && (char *) prev->payload + prev->block_size > (char *) block->payload)
+        || (next != NULL && (char *) block->payload + block->block_size > (char *) next->payload)) {
+        malloc_error(curr_op, "umalloc returned a block overlapping an allocated block.");
+        return -1;
+    }
+
+    memmove(&live_ids[pos + 1], &live_ids[pos], (num_live - pos) * sizeof(size_t));
+    live_ids[pos] = block_id;
+    num_live++;
+    return check_live(trace, pos - 1, curr_op) == -1 || check_live(trace, pos + 1, curr_op) == -1 ? -1 : 0;
+}
+
+/* 
+ * live_remove - Takes a block that is being freed or moved out of the live
+ * index, the blocks that were on either side of it are checked once umalloc
+ * is done with it by check_removed.
+ */
+static size_t live_remove(trace_t *trace, size_t block_id) {
+    size_t pos = live_position(trace, trace->blocks[block_id].payload);
+    while (live_ids[pos] != block_id) {
+        pos++;
+    }
+    memmove(&live_ids[pos], &live_ids[pos + 1], (num_live - pos - 1) * sizeof(size_t));
+    num_live--;
+    return pos;
+}
+
+/* 
+ * check_removed - Checks the blocks that were on either side of a block
+ * removed from position pos of the live index.
+ */
+static int check_removed(trace_t *trace, size_t pos, size_t curr_op) {
+    return check_live(trace, pos - 1, curr_op) == -1 || check_live(trace, pos, curr_op) == -1 ? -1 : 0;
+}
+
+/* 
+ * check_payload - Checks that a payload returned by umalloc or urealloc is 
+ * non NULL, aligned to 16 bytes and rests within the sbrk range.
+ */
+static int check_payload(void *payload, size_t block_size, size_t curr_op) {
+    if (payload == NULL) {
+        malloc_error(curr_op, "umalloc failed.");
+        return -1;
+    }
+
+    if (((size_t)payload) % ALIGNMENT != 0) {
+        malloc_error(curr_op, "umalloc returned an unaligned payload.");
+        printf("The payload is: %li\n", ((size_t)payload));
+        return -1;
+    }
+
+    if(check_malloc_output(payload, block_size) == -1) {
+        printf("line %ld: umalloc allocated a block out of bounds.\n", LINENUM(curr_op));
+        return -1;
+    }
+    return 0;
+}
+
 size_t curr_bytes_in_use;
 size_t max_bytes_in_use;
 
@@ -88,53 +236,155 @@ size_t max_bytes_in_use;
  * UTILIZATION_SCORE - the utilization score represents how well the umalloc
  * package uses the bytes requested from sbrk. For example, if 100 bytes are
  * requested from sbrk, and the user requested 80 bytes, there will be a 
- * utilization score of 80%.
+ * utilization score of 80%. The bytes requested from sbrk and mmap are counted
+ * at their peak, memory umalloc gives back does not raise the score.
+ */
+#define UTILIZATION_SCORE 100.0 * max_bytes_in_use / max_footprint_bytes
+
+/* 
+ * print_footprint - Prints the most bytes umalloc ever held from sbrk and mmap
+ * at once, how many it holds now, and what umalloc_stats says about the heap.
+ */
+static void print_footprint() {
+    printf("Peak footprint: %lu bytes\n", max_footprint_bytes);
+    printf("Final footprint: %lu bytes (%lu bytes released)\n", sbrk_bytes + mmap_bytes, released_bytes);
+#ifndef UMALLOC_NO_STATS
+    umalloc_stats_t stats;
+    umalloc_stats(&stats);
+    printf("Heap: %lu bytes held, %lu in use, %lu free, largest free block %lu, fragmentation %.2f\n",
+        stats.bytes_held, stats.bytes_in_use, stats.bytes_free, stats.largest_free, stats.fragmentation);
+    printf("Heap: %lu csbrk calls, %lu splits, %lu coalesces\n", stats.csbrk_calls, stats.splits, stats.coalesces);
+#endif
+}
+
+/* 
+ * parse_dump_lines - Reads the comma separated trace lines given to -d and sorts them.
+ */
+static void parse_dump_lines(char *arg) {
+    num_dump_lines = 1;
+    for (char *c = arg; *c != '\0'; c++) {
+        num_dump_lines += *c == ',';
+    }
+    dump_lines = calloc(num_dump_lines, sizeof(size_t));
+    char *line = strtok(arg, ",");
+    for (size_t i = 0; i < num_dump_lines && line != NULL; i++, line = strtok(NULL, ",")) {
+        dump_lines[i] = strtoul(line, NULL, 10);
+    }
+
+    //the lines are few, an insertion sort will do
+    for (size_t i = 1; i < num_dump_lines; i++) {
+        size_t line = dump_lines[i];
+        size_t j = i;
+        for (; j > 0 && dump_lines[j - 1] > line; j--) {
+            dump_lines[j] = dump_lines[j - 1];
+        }
+        dump_lines[j] = line;
+    }
+}
+
+/* 
+ * dump_heap_at - Dumps the heap to heap_<line>.csv and prints its summary, skipping
+ * every requested line up to line, since they all see the same heap. At the end of a
+ * run it is called with the last requested line to dump the final heap.
+ */
+static void dump_heap_at(size_t line) {
+    char filename[MAXLINE];
+    snprintf(filename, MAXLINE, "heap_%lu.csv", line);
+    if (dump_heap(filename, stdout) == -1) {
+        fprintf(stderr, "Could not write the heap dump %s\n", filename);
+    }
+    while (next_dump_line < num_dump_lines && dump_lines[next_dump_line] <= line) {
+        next_dump_line++;
+    }
+}
+
+/* 
+ * print_heap_error - Prints what the last failed check_heap found wrong.
  */
-#define UTILIZATION_SCORE 100.0 * max_bytes_in_use / sbrk_bytes
+static void print_heap_error() {
+    void *block;
+    const char *error = check_heap_error(&block);
+    printf("check_heap: %s (block %p)\n", error, block);
+}
 
 /* 
  * run_trace_line - Runs a single line in the trace. Checking if all the 
  * correctness checks are still satisfied after the check. Checks if the returned
  * payload is aligned to 16 bytes, hasn't affected any other blocks, and rests
  * within the sbrk range. Runs the user created check heap function and prints
- * the current utilization score if requested. 
+ * the current utilization score if requested. run_check_heap is the number of
+ * ops between heap checks, 0 for none. 
  */
-static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int run_check_heap) {
+static int run_trace_line(trace_t *trace, traceop_t op, size_t curr_op, int utilization, int run_check_heap) {
 
     if (curr_op % 5 == 0) {
         void *ret = sbrk(4096);
         mprotect(ret, 4096, PROT_NONE);
     }
-    traceop_t op = trace->ops[curr_op];
-    if (op.type == ALLOC) {
+    if (op.type == ALLOC || op.type == CALLOC) {
         trace->blocks[op.index].is_allocated = true;
         trace->blocks[op.index].content_val = curr_op;
         trace->blocks[op.index].block_size = op.size;
 
         if (verbose) {
-            printf("line %ld: umalloc: id %d, Allocating %d bytes\n", LINENUM(curr_op), op.index, op.size);
+            printf("line %ld: %s: id %d, Allocating %d bytes\n", LINENUM(curr_op), 
+                op.type == ALLOC ? "umalloc" : "ucalloc", op.index, op.size);
         }
 
-        trace->blocks[op.index].payload = umalloc(op.size);
+        if (op.type == ALLOC) {
+            trace->blocks[op.index].payload = umalloc(op.size);
+        } else {
+            trace->blocks[op.index].payload = ucalloc(1, op.size);
+        }
         curr_bytes_in_use += op.size;
-        if ( trace->blocks[op.index].payload == NULL) {
-            malloc_error(curr_op, "umalloc failed.");
+        if (check_payload(trace->blocks[op.index].payload, trace->blocks[op.index].block_size, curr_op) == -1) {
             return -1;
         }
 
-        if (((size_t)trace->blocks[op.index].payload) % ALIGNMENT != 0) {
-            malloc_error(curr_op, "umalloc returned an unaligned payload.");
-            printf("The payload is: %li\n", ((size_t)trace->blocks[op.index].payload));
+        if (op.type == CALLOC && check_zero(trace->blocks[op.index].payload, op.size) == -1) {
+            malloc_error(curr_op, "ucalloc returned a block that is not zeroed.");
             return -1;
         }
 
-        if(check_malloc_output(trace->blocks[op.index].payload, trace->blocks[op.index].block_size) == -1) {
-            printf("line %ld: umalloc allocated a block out of bounds.\n", LINENUM(curr_op));
+        copy_id((size_t*) trace->blocks[op.index].payload, trace->blocks[op.index].block_size, curr_op);
+        if (live_insert(trace, op.index, curr_op) == -1) {
             return -1;
         }
+    } else if (op.type == REALLOC) {
+        allocated_block_t *block = &trace->blocks[op.index];
 
-        copy_id((size_t*) trace->blocks[op.index].payload, trace->blocks[op.index].block_size, curr_op);
+        //a freed or never allocated id is resized from nothing, its old payload is gone
+        void *old_payload = block->is_allocated ? block->payload : NULL;
+        size_t old_size = block->is_allocated ? block->block_size : 0;
+        size_t kept_size = old_size < op.size ? old_size : op.size;
+
+        if (verbose) {
+            printf("line %ld: urealloc: id %d, Resizing to %d bytes\n", LINENUM(curr_op), op.index, op.size);
+        }
+
+        size_t old_pos = block->is_allocated ? live_remove(trace, op.index) : SIZE_MAX;
+        void *payload = urealloc(old_payload, op.size);
+        if (check_payload(payload, op.size, curr_op) == -1) {
+            return -1;
+        }
+
+        if (check_id(payload, kept_size, block->content_val) == -1) {
+            malloc_error(curr_op, "urealloc did not keep the contents of the block.");
+            return -1;
+        }
+
+        curr_bytes_in_use += op.size;
+        curr_bytes_in_use -= old_size;
+        block->payload = payload;
+        block->is_allocated = true;
+        block->content_val = curr_op;
+        block->block_size = op.size;
+        copy_id((size_t*) block->payload, block->block_size, curr_op);
+        if (check_removed(trace, old_pos, curr_op) == -1 || live_insert(trace, op.index, curr_op) == -1) {
+            return -1;
+        }
     } else {
+        size_t old_pos = trace->blocks[op.index].is_allocated ? live_remove(trace, op.index) : SIZE_MAX;
         trace->blocks[op.index].is_allocated = false;
 
         if (verbose) {
@@ -143,22 +393,28 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
 
         ufree(trace->blocks[op.index].payload);
         curr_bytes_in_use -= trace->blocks[op.index].block_size;
+        if (check_removed(trace, old_pos, curr_op) == -1) {
+            return -1;
+        }
     }
 
     if (curr_bytes_in_use > max_bytes_in_use) {
         max_bytes_in_use = curr_bytes_in_use;
     }
 
-    if (run_check_heap) {
-        if (check_heap() != 0) {
-            malloc_error(curr_op, "check heap failed.");
-            return -1;
-        } else {
-            printf("Passed check heap.\n");
-        }
+    if (run_check_heap && (curr_op + 1) % run_check_heap == 0 && check_heap() != 0) {
+        print_heap_error();
+        malloc_error(curr_op, "check heap failed.");
+        return -1;
+    }
+
+    if (walk_heap_every != 0 && (curr_op + 1) % walk_heap_every == 0 && check_heap_walk() != 0) {
+        print_heap_error();
+        malloc_error(curr_op, "check heap walk failed.");
+        return -1;
     }
 
-    if (check_correctness(trace, curr_op) == -1) {
+    if (full_check_every != 0 && (curr_op + 1) % full_check_every == 0 && check_correctness(trace, curr_op) == -1) {
         printf("line %ld failed the correctness check.\n", LINENUM(curr_op));
         return -1;
     }
@@ -167,6 +423,10 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
         printf("Current Utilization percentage: %.2f\n", UTILIZATION_SCORE);
     }
 
+    if (next_dump_line < num_dump_lines && LINENUM(curr_op) >= dump_lines[next_dump_line]) {
+        dump_heap_at(LINENUM(curr_op));
+    }
+
   return 0;
 }
 
@@ -182,20 +442,61 @@ static int auto_run_trace(trace_t *trace, int utilization, int run_check_heap, s
     }
 
     for(;curr_op < trace->num_ops; curr_op++) {
-        if (run_trace_line(trace, curr_op, utilization, run_check_heap) == -1) {
+        if (run_trace_line(trace, trace->ops[curr_op], curr_op, utilization, run_check_heap) == -1) {
             printf("umalloc package failed.\n");
             exit(1);
         }
     }
 
+    if (check_correctness(trace, curr_op - 1) == -1) {
+        printf("umalloc package failed.\n");
+        exit(1);
+    }
     printf("umalloc package passed correctness check.\n");
+    if (next_dump_line < num_dump_lines) {
+        dump_heap_at(dump_lines[num_dump_lines - 1]);
+    }
 
     if (utilization) {
         printf("Final Utilization percentage: %.2f\n", UTILIZATION_SCORE);
+        print_footprint();
     }
     return curr_op;
 }
 
+/* 
+ * auto_run_stream - Runs a streamed trace to completion chunk by chunk, with the
+ * same checks as auto_run_trace. 
+ */
+static void auto_run_stream(trace_stream_t *stream, int utilization, int run_check_heap) {
+    size_t curr_op = 0;
+    traceop_t *ops;
+    int count;
+
+    while ((ops = next_trace_chunk(stream, &count)) != NULL) {
+        for (int i = 0; i < count; i++, curr_op++) {
+            if (run_trace_line(&stream->trace, ops[i], curr_op, utilization, run_check_heap) == -1) {
+                printf("umalloc package failed.\n");
+                exit(1);
+            }
+        }
+    }
+
+    if (check_correctness(&stream->trace, curr_op - 1) == -1) {
+        printf("umalloc package failed.\n");
+        exit(1);
+    }
+    printf("umalloc package passed correctness check.\n");
+    if (next_dump_line < num_dump_lines) {
+        dump_heap_at(dump_lines[num_dump_lines - 1]);
+    }
+
+    if (utilization) {
+        printf("Final Utilization percentage: %.2f\n", UTILIZATION_SCORE);
+        print_footprint();
+    }
+}
+
 /* 
  * help - Prints the help information for the Trace Runner.
  */
@@ -204,7 +505,7 @@ void help() {
     printf("go               -  run trace to completion         \n");
     printf("run n            -  execute trace for n ops\n");
     printf("check            -  run the heap_check                \n");
-    printf("util             -  display current heap utilization   \n");
+    printf("util             -  display current heap utilization and footprint\n");
     printf("help             -  display this help menu            \n");
     printf("quit             -  exit the program                  \n\n");
 }
@@ -237,9 +538,11 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
     case 'C':
     case 'c':
         printf("Running check_heap.\n");
-        ret = check_heap();
-        if (ret != 0)
+        ret = check_heap_walk();
+        if (ret != 0) {
+            print_heap_error();
             printf("check_heap returned non zero exit code.\n");
+        }
         break;
 
     case 'h':
@@ -255,6 +558,7 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
     case 'U':
     case 'u':
         printf("Current Utilization percentage: %.2f\n", UTILIZATION_SCORE);
+        print_footprint();
         break;
 
     case 'R':
@@ -270,19 +574,27 @@ void interactive_run_trace(trace_t *trace, int utilization, int run_check_heap)
         }
 
         for(int op = 0; op < ops_to_run; op++) {
-            if (run_trace_line(trace, curr_op, utilization, run_check_heap) == -1) {
+            if (run_trace_line(trace, trace->ops[curr_op], curr_op, utilization, run_check_heap) == -1) {
                 printf("umalloc package failed.\n");
                 exit(1);
             }
             curr_op++;
             if (curr_op == trace->num_ops) {
+                if (check_correctness(trace, curr_op - 1) == -1) {
+                    printf("umalloc package failed.\n");
+                    exit(1);
+                }
                 printf("umalloc package passed correctness check.\n");
+                if (next_dump_line < num_dump_lines) {
+                    dump_heap_at(dump_lines[num_dump_lines - 1]);
+                }
                 break;
             }
         }
 
         if (utilization && curr_op >= trace->num_ops) {
             printf("Final Utilization percentage: %.2f\n", UTILIZATION_SCORE);
+            print_footprint();
         }
 
         break;
@@ -299,12 +611,12 @@ int main(int argc, char **argv)
 {
 
   char c;
-  int autorun = 0, run_check_heap = 0, display_utilization = 0;
+  int autorun = 0, run_check_heap = 0, display_utilization = 0, stream = 0;
 
   /* 
     * Read and interpret the command line arguments 
     */
-  while ((c = getopt(argc, argv, "rvhcu")) != EOF) {
+  while ((c = getopt(argc, argv, "rvhcusf:d:k:")) != EOF) {
     switch (c) {
     case 'r': /* Generate summary info for the autograder */
         autorun = 1;
@@ -318,9 +630,21 @@ int main(int argc, char **argv)
     case 'c':
         run_check_heap = 1;
         break;
+    case 'k':
+        walk_heap_every = strtoul(optarg, NULL, 10);
+        break;
     case 'u':
         display_utilization = 1;
         break;
+    case 's':
+        stream = 1;
+        break;
+    case 'f':
+        full_check_every = strtoul(optarg, NULL, 10);
+        break;
+    case 'd':
+        parse_dump_lines(optarg);
+        break;
     default:
         usage();
         exit(1);
@@ -344,14 +668,37 @@ int main(int argc, char **argv)
         }
 
         if (run_check_heap) {
-           printf("Running Check Heap After Each Op.\n");
+           printf("Running Check Heap Every %d Ops.\n", run_check_heap);
+        }
+
+        if (walk_heap_every) {
+           printf("Walking The Heap Every %lu Ops.\n", walk_heap_every);
         }
     }
 
     printf("Welcome to the MM lab runner\n\n");
     printf("Author: %s\n", author);
 
+    if (stream) {
+        if (!autorun) {
+            usage();
+            appl_error("Streaming only runs traces to completion, use it with -r.");
+        }
+        trace_stream_t *trace_stream = open_trace_stream(file, verbose);
+        init_live_index(&trace_stream->trace);
+        if (uinit() == -1) {
+            malloc_error(-3, "uinit failed.");
+            exit(1);
+        }
+        curr_bytes_in_use = 0;
+        max_bytes_in_use = 0;
+        auto_run_stream(trace_stream, display_utilization, run_check_heap);
+        close_trace_stream(trace_stream);
+        return 0;
+    }
+
     trace_t *trace = read_trace(file, verbose);
+    init_live_index(trace);
     if (uinit() == -1) {
         malloc_error(-3, "uinit failed.");
         exit(1);
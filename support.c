@@ -9,8 +9,12 @@
 
 #include "support.h"
 #include "err_handler.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <endian.h>
 
-char msg[MAXLINE];      /* for whenever we need to compose an error message */
+static char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* 
  * appl_error - Report an arbitrary application error
@@ -34,20 +38,129 @@ void malloc_error(int opnum, char *msg)
 }
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_text_op - parse the next request line of a text trace into op,
+ * returns EOF once there are no lines left
+ */
+static int read_text_op(FILE *tracefile, traceop_t *op, char *filename)
+{
+    char type[MAXLINE];
+    unsigned index = 0;
+    unsigned size = 0;
+    int err;
+
+    if (fscanf(tracefile, "%s", type) == EOF)
+        return EOF;
+    switch(type[0]) {
+    case 'a':
+    case 'r':
+    case 'c':
+        err = fscanf(tracefile, "%u %u", &index, &size);
+        if (err == EOF) {
+            appl_error("fscanf failed to find index and size.");
+        }
+        op->type = type[0] == 'a' ? ALLOC : type[0] == 'r' ? REALLOC : CALLOC;
+        op->index = index;
+        op->size = size;
+        if (op->size < 0) {
+            sprintf(msg, "Bogus size %u in tracefile %s", size, filename);
+            appl_error(msg);
+        }
+        break;
+    case 'f':
+        err = fscanf(tracefile, "%ud", &index);
+        if (err == EOF) {
+            appl_error("fscanf failed to find index.");
+        }
+        op->type = FREE;
+        op->index = index;
+        op->size = 0;
+        break;
+    default:
+        sprintf(msg, "Bogus type character (%c) in tracefile %s\n", type[0], filename);
+        appl_error(msg);
+    }
+    return 0;
+}
+
+/*
+ * check_op - make sure a request read without the full trace at hand has a known
+ * type, an id inside the block array and a size that fits traceop_t
+ */
+static void check_op(traceop_t *op, int num_ids, size_t op_num, char *filename)
+{
+    if ((unsigned) op->type > CALLOC || (unsigned) op->index >= (unsigned) num_ids || op->size < 0) {
+        sprintf(msg, "Bogus request %lu in tracefile %s", op_num, filename);
+        appl_error(msg);
+    }
+}
+
+/*
+ * read_binary_trace - map a binary trace file and point the op array straight into
+ * the mapping, without parsing or copying the requests
+ */
+static void read_binary_trace(trace_t *trace, int fd, char *filename)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(trace_header_t)) {
+        sprintf(msg, "Could not stat %s in read_trace", filename);
+        appl_error(msg);
+    }
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+        appl_error("mmap failed in read_trace");
+
+    trace_header_t *header = (trace_header_t *) trace->map;
+    trace->num_ids = le32toh(header->num_ids);
+    trace->num_ops = le32toh(header->num_ops);
+    if (trace->num_ids < 0 || trace->num_ops < 0
+        || trace->map_size != sizeof(trace_header_t) + (size_t) trace->num_ops * sizeof(trace_record_t)) {
+        sprintf(msg, "Binary tracefile %s is truncated or corrupt", filename);
+        appl_error(msg);
+    }
+
+    /* records share the layout of traceop_t, so on a little-endian host they are used in place */
+    _Static_assert(sizeof(traceop_t) == sizeof(trace_record_t), "trace records must match traceop_t");
+    trace_record_t *records = (trace_record_t *) (header + 1);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    trace->ops = (traceop_t *) records;
+#else
+    trace->ops = (traceop_t *) calloc(trace->num_ops, sizeof(traceop_t));
+    if (trace->ops == NULL)
+        appl_error("Failed to allocate op array");
+    for (int i = 0; i < trace->num_ops; i++) {
+        trace->ops[i].type = le32toh(records[i].type);
+        trace->ops[i].index = le32toh(records[i].index);
+        trace->ops[i].size = le32toh(records[i].size);
+    }
+#endif
+
+    /* a bad record would index past the block array, so every one is checked once */
+    for (int i = 0; i < trace->num_ops; i++) {
+        check_op(&trace->ops[i], trace->num_ids, i, filename);
+    }
+
+    trace->blocks = (allocated_block_t *)calloc(trace->num_ids, sizeof(allocated_block_t));
+    if (trace->blocks == NULL)
+        appl_error("Failed to allocate block array");
+}
+
+/*
+ * read_trace - read a trace file and store it in memory. Files starting with
+ * TRACE_MAGIC are binary traces and are mapped, others are parsed as text.
  */
 trace_t *read_trace(char *filename, int verbose)
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
+    char magic[sizeof(((trace_header_t *) 0)->magic)];
     int err;
 
     if (verbose)
         printf("Reading tracefile: %s\n", filename);
 
     /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
         appl_error("malloc 1 failed in read_trace");
 
     /* Read the trace file header */
@@ -56,6 +169,15 @@ trace_t *read_trace(char *filename, int verbose)
         appl_error(msg);
     }
 
+    /* binary traces are told apart by their magic */
+    if (fread(magic, 1, sizeof(magic), tracefile) == sizeof(magic)
+        && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+        read_binary_trace(trace, fileno(tracefile), filename);
+        fclose(tracefile);
+        return trace;
+    }
+    rewind(tracefile);
+
     err = fscanf(tracefile, "%d", &(trace->num_ids)); 
     if (err == EOF) {
         appl_error("fscanf failed to find num ids.");
@@ -78,36 +200,14 @@ trace_t *read_trace(char *filename, int verbose)
 
     
     /* read every request line in the trace file */
-    unsigned index = 0;
     unsigned op_index = 0;
     unsigned max_index = 0;
-    unsigned size = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch(type[0]) {
-        case 'a':
-            err = fscanf(tracefile, "%u %u", &index, &size);
-            if (err == EOF) {
-                appl_error("fscanf failed to find index and size.");
-            }
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
+    while (read_text_op(tracefile, &trace->ops[op_index], filename) != EOF) {
+        if (trace->ops[op_index].type != FREE) {
+            unsigned index = trace->ops[op_index].index;
             max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            err = fscanf(tracefile, "%ud", &index);
-            if (err == EOF) {
-                appl_error("fscanf failed to find index.");
-            }
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-        break;
-        default:
-            sprintf(msg, "Bogus type character (%c) in tracefile %s\n", type[0], filename);
-            appl_error(msg);
         }
         op_index++;
-
     }
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
@@ -116,13 +216,202 @@ trace_t *read_trace(char *filename, int verbose)
     return trace;
 }
 
+/*
+ * write_trace - write a trace in the binary format read_trace maps
+ */
+void write_trace(trace_t *trace, char *filename)
+{
+    FILE *tracefile;
+    if ((tracefile = fopen(filename, "w")) == NULL) {
+        sprintf(msg, "Could not open %s in write_trace", filename);
+        appl_error(msg);
+    }
+
+    trace_header_t header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.num_ids = htole32(trace->num_ids);
+    header.num_ops = htole32(trace->num_ops);
+    if (fwrite(&header, sizeof(header), 1, tracefile) != 1)
+        appl_error("fwrite failed to write the trace header.");
+
+    for (int i = 0; i < trace->num_ops; i++) {
+        trace_record_t record;
+        record.type = htole32(trace->ops[i].type);
+        record.index = htole32(trace->ops[i].index);
+        record.size = htole32(trace->ops[i].type == FREE ? 0 : trace->ops[i].size);
+        if (fwrite(&record, sizeof(record), 1, tracefile) != 1)
+            appl_error("fwrite failed to write a trace record.");
+    }
+    if (fclose(tracefile) != 0)
+        appl_error("fclose failed in write_trace.");
+}
+
 /*
  * free_trace - Free the trace record and the two arrays it points
  *              to, all of which were allocated in read_trace().
+ *              Ops of a mapped binary trace go with the mapping.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the two arrays... */
+    if (trace->map != NULL) {
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+        free(trace->ops);
+#endif
+        munmap(trace->map, trace->map_size);
+    } else {
+        free(trace->ops);         /* free the two arrays... */
+    }
     free(trace->blocks);      
     free(trace);              /* and the trace record itself... */
-}
\ No newline at end of file
+}
+
+/*
+ * stream_reader - body of the reader thread of a trace stream. Fills the buffers
+ * in turn, waiting for the caller to give a buffer back before refilling it, and
+ * ends after handing out an empty chunk at the end of the trace.
+ */
+static void *stream_reader(void *arg)
+{
+    trace_stream_t *stream = (trace_stream_t *) arg;
+    size_t op_num = 0;
+    int count;
+
+    for (int buffer = 0; ; buffer ^= 1) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->filled[buffer])
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        pthread_mutex_unlock(&stream->lock);
+
+        /* parsing happens outside the lock, while the caller replays the other buffer */
+        traceop_t *chunk = stream->chunks[buffer];
+        if (stream->binary) {
+            trace_record_t *records = (trace_record_t *) chunk;
+            count = fread(records, sizeof(trace_record_t), STREAM_CHUNK_OPS, stream->file);
+            for (int i = 0; i < count; i++) {
+                trace_record_t record = records[i];
+                chunk[i].type = le32toh(record.type);
+                chunk[i].index = le32toh(record.index);
+                chunk[i].size = le32toh(record.size);
+            }
+        } else {
+            for (count = 0; count < STREAM_CHUNK_OPS; count++) {
+                if (read_text_op(stream->file, &chunk[count], stream->filename) == EOF)
+                    break;
+            }
+        }
+        for (int i = 0; i < count; i++)
+            check_op(&chunk[i], stream->trace.num_ids, op_num++, stream->filename);
+        if (count == 0 && op_num != (size_t) stream->trace.num_ops) {
+            sprintf(msg, "Tracefile %s holds %lu requests, its header says %d", stream->filename, op_num, stream->trace.num_ops);
+            appl_error(msg);
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        stream->counts[buffer] = count;
+        stream->filled[buffer] = true;
+        pthread_cond_broadcast(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+        if (count == 0)
+            return NULL;
+    }
+}
+
+/*
+ * open_trace_stream - read the header of a text or binary trace and start the
+ * reader thread on its requests. Only the block array is allocated up front.
+ */
+trace_stream_t *open_trace_stream(char *filename, int verbose)
+{
+    trace_stream_t *stream;
+    char magic[sizeof(((trace_header_t *) 0)->magic)];
+
+    if (verbose)
+        printf("Streaming tracefile: %s\n", filename);
+
+    if ((stream = (trace_stream_t *) calloc(1, sizeof(trace_stream_t))) == NULL)
+        appl_error("malloc failed in open_trace_stream");
+    if ((stream->file = fopen(filename, "r")) == NULL) {
+        sprintf(msg, "Could not open %s in open_trace_stream", filename);
+        appl_error(msg);
+    }
+    stream->filename = filename;
+
+    /* a binary header is read whole, a text one number by number */
+    stream->binary = fread(magic, 1, sizeof(magic), stream->file) == sizeof(magic)
+        && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+    if (stream->binary) {
+        trace_header_t header;
+        rewind(stream->file);
+        if (fread(&header, sizeof(header), 1, stream->file) != 1)
+            appl_error("fread failed to read the trace header.");
+        stream->trace.num_ids = le32toh(header.num_ids);
+        stream->trace.num_ops = le32toh(header.num_ops);
+    } else {
+        rewind(stream->file);
+        if (fscanf(stream->file, "%d", &stream->trace.num_ids) == EOF)
+            appl_error("fscanf failed to find num ids.");
+        if (fscanf(stream->file, "%d", &stream->trace.num_ops) == EOF)
+            appl_error("fscanf failed to find num ops.");
+    }
+    if (stream->trace.num_ids < 0 || stream->trace.num_ops < 0) {
+        sprintf(msg, "Tracefile %s has a bogus header", filename);
+        appl_error(msg);
+    }
+
+    stream->trace.blocks = (allocated_block_t *)calloc(stream->trace.num_ids, sizeof(allocated_block_t));
+    if (stream->trace.blocks == NULL)
+        appl_error("Failed to allocate block array");
+    for (int i = 0; i < 2; i++) {
+        if ((stream->chunks[i] = (traceop_t *) malloc(STREAM_CHUNK_OPS * sizeof(traceop_t))) == NULL)
+            appl_error("Failed to allocate chunk buffer");
+    }
+    stream->current = -1;
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+    if (pthread_create(&stream->reader, NULL, stream_reader, stream) != 0)
+        appl_error("Failed to start the trace reader thread");
+    return stream;
+}
+
+/*
+ * next_trace_chunk - give the buffer of the last chunk back to the reader and
+ * wait for the next one. Returns the requests and stores how many there are in
+ * count, or returns NULL at the end of the trace.
+ */
+traceop_t *next_trace_chunk(trace_stream_t *stream, int *count)
+{
+    pthread_mutex_lock(&stream->lock);
+    int buffer = stream->current < 0 ? 0 : stream->current ^ 1;
+    if (stream->current >= 0) {
+        stream->filled[stream->current] = false;
+        pthread_cond_broadcast(&stream->changed);
+    }
+    while (!stream->filled[buffer])
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    stream->current = buffer;
+    *count = stream->counts[buffer];
+    pthread_mutex_unlock(&stream->lock);
+    return *count == 0 ? NULL : stream->chunks[buffer];
+}
+
+/*
+ * close_trace_stream - stop the reader thread and free everything the stream holds
+ */
+void close_trace_stream(trace_stream_t *stream)
+{
+    /* the reader may be waiting for a buffer, reading on to the end lets it finish */
+    int count;
+    if (stream->current < 0 || stream->counts[stream->current] != 0) {
+        while (next_trace_chunk(stream, &count) != NULL)
+            ;
+    }
+    pthread_join(stream->reader, NULL);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->changed);
+    fclose(stream->file);
+    free(stream->chunks[0]);
+    free(stream->chunks[1]);
+    free(stream->trace.blocks);
+    free(stream);
+}
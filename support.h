@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
 
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       2 /* number of header lines in a trace file */
@@ -33,9 +34,9 @@ typedef struct {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, CALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc request */
+    int size;                         /* byte size of alloc, realloc or calloc request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -44,9 +45,52 @@ typedef struct {
     int num_ops;         /* number of distinct requests */
     traceop_t *ops;      /* array of requests */
     allocated_block_t *blocks; /* array of blocks returned by umalloc */
+    void *map;           /* mapping of a binary trace file that ops points into, NULL for text traces */
+    size_t map_size;     /* length of that mapping */
 } trace_t;
 
+#define TRACE_MAGIC "UMTRACE1" /* first 8 bytes of a binary trace file */
+
+/* Header of a binary trace file, followed by num_ops records */
+typedef struct {
+    char magic[8];
+    uint32_t num_ids;
+    uint32_t num_ops;
+} trace_header_t;
+
+/* One request of a binary trace file, little-endian and laid out like traceop_t */
+typedef struct {
+    uint32_t type;                    /* ALLOC, FREE, REALLOC or CALLOC */
+    uint32_t index;
+    uint32_t size;                    /* 0 for free */
+} trace_record_t;
+
+#define STREAM_CHUNK_OPS 65536 /* requests per buffer of a streamed trace */
+
+/*
+ * Reads a trace in chunks of STREAM_CHUNK_OPS requests instead of all at once.
+ * A reader thread fills one buffer while the caller replays the other, so only
+ * two chunks of requests are held in memory however long the trace is.
+ */
+typedef struct {
+    trace_t trace;          /* num_ids, num_ops and blocks, ops stays NULL */
+    FILE *file;
+    char *filename;
+    bool binary;            /* whether file holds records rather than text lines */
+    traceop_t *chunks[2];   /* the two buffers */
+    int counts[2];          /* requests in a filled buffer, 0 once the trace is done */
+    bool filled[2];         /* set by the reader, cleared once the caller is done with the buffer */
+    int current;            /* buffer the caller holds, -1 before the first chunk */
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t changed; /* signaled whenever a buffer is filled or given back */
+} trace_stream_t;
+
 void appl_error(char *msg);
 void malloc_error(int opnum, char *msg);
 trace_t *read_trace(char *filename, int verbose);
-void free_trace(trace_t *trace);
\ No newline at end of file
+void write_trace(trace_t *trace, char *filename);
+void free_trace(trace_t *trace);
+trace_stream_t *open_trace_stream(char *filename, int verbose);
+traceop_t *next_trace_chunk(trace_stream_t *stream, int *count);
+void close_trace_stream(trace_stream_t *stream);
\ No newline at end of file
@@ -77,11 +77,11 @@ while ($line = <STDIN>) {
     # save the line for output later
     $lines[$requestnum++] = $line;
 
-    if ($cmd eq "a" and $HASH{$id} eq "a") {
+    if (($cmd eq "a" or $cmd eq "c") and ($HASH{$id} eq "a" or $HASH{$id} eq "c")) {
 	die "$0: ERROR[$linenum]: allocate with no intervening free.\n";
     }
 
-    if ($cmd eq "a" and $HASH{$id} eq "f") {
+    if (($cmd eq "a" or $cmd eq "c") and $HASH{$id} eq "f") {
 	die "$0: ERROR[$linenum]: reused ID $id.\n";
     }
 
@@ -132,7 +132,7 @@ foreach $item (@lines) {
 
 # print a set of free requests that will balance the trace
 foreach $key (sort keys %HASH) {
-    if ($HASH{$key} ne "a" and $HASH{$key} ne "r") {
+    if ($HASH{$key} ne "a" and $HASH{$key} ne "r" and $HASH{$key} ne "c") {
 	die "$0: ERROR: Invalid free request in residue.\n";
     }
     print "f $key\n";
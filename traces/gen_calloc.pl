@@ -0,0 +1,40 @@
+#!/usr/bin/perl
+
+$out_filename = "calloc.rep";
+$num_iters = 2400;
+$max_blk_size = 4096;
+$live_blocks = 16;
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Every iteration allocates and fills a plain block, allocates a
+# zeroed block, frees the plain block and frees the zeroed block
+# allocated $live_blocks iterations ago.
+srand(429);
+@lines = ();
+for ($i = 0;  $i < $num_iters; $i += 1) {
+    $plain = 2*$i;
+    $zeroed = 2*$i + 1;
+    $plain_size = int(rand $max_blk_size) + 1;
+    $zeroed_size = int(rand $max_blk_size) + 1;
+    push @lines, "a $plain $plain_size";
+    push @lines, "c $zeroed $zeroed_size";
+    push @lines, "f $plain";
+    if ($i >= $live_blocks) {
+	$old = 2*($i - $live_blocks) + 1;
+	push @lines, "f $old";
+    }
+}
+
+# Calculate misc parameters
+$num_blocks = 2*$num_iters;
+$num_ops = scalar @lines;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+foreach $line (@lines) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
@@ -0,0 +1,44 @@
+#!/usr/bin/perl
+
+$out_filename = "large.rep";
+$num_iters = 1200;
+$max_small_size = 4096;
+$max_large_size = 1048576;
+$live_blocks = 8;
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Every iteration allocates a small block and a block of up to 1 MB,
+# resizes an older large block across the size range, and frees the
+# blocks allocated $live_blocks iterations ago.
+srand(429);
+@lines = ();
+for ($i = 0;  $i < $num_iters; $i += 1) {
+    $small = 2*$i;
+    $large = 2*$i + 1;
+    $small_size = int(rand $max_small_size) + 1;
+    $large_size = int(rand $max_large_size) + 1;
+    push @lines, "a $small $small_size";
+    push @lines, "a $large $large_size";
+    if ($i >= $live_blocks) {
+	$old_small = 2*($i - $live_blocks);
+	$old_large = $old_small + 1;
+	$resize = int(rand $max_large_size) + 1;
+	push @lines, "r $old_large $resize";
+	push @lines, "f $old_small";
+	push @lines, "f $old_large";
+    }
+}
+
+# Calculate misc parameters
+$num_blocks = 2*$num_iters;
+$num_ops = scalar @lines;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+foreach $line (@lines) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
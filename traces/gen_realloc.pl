@@ -0,0 +1,43 @@
+#!/usr/bin/perl
+
+$out_filename = "realloc.rep";
+$start_size = 512;
+$grow_size = 128;
+$small_size = 128;
+$num_rounds = 20;
+$num_steps = 200;
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Each round grows one block while small blocks are allocated and
+# freed around it, then frees the grown block.
+@lines = ();
+for ($r = 0;  $r < $num_rounds; $r += 1) {
+    $big = $r;
+    $size = $start_size;
+    push @lines, "a $big $size";
+    for ($i = 0;  $i < $num_steps; $i += 1) {
+	$size += $grow_size;
+	$small = $num_rounds + $r*$num_steps + $i;
+	push @lines, "r $big $size";
+	push @lines, "a $small $small_size";
+	if ($i > 0) {
+	    $prev = $small - 1;
+	    push @lines, "f $prev";
+	}
+    }
+    push @lines, "f $big";
+}
+
+# Calculate misc parameters
+$num_blocks = $num_rounds + $num_rounds*$num_steps;
+$num_ops = scalar @lines;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+foreach $line (@lines) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
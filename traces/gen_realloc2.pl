@@ -0,0 +1,34 @@
+#!/usr/bin/perl
+
+$out_filename = "realloc2.rep";
+$start_size = 4092;
+$grow_size = 5;
+$small_size = 16;
+$num_iters = 4800;
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$num_blocks = $num_iters + 1;
+$num_ops = 3*$num_iters;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+
+# One block slowly grows while a small block is allocated after it
+# every step and the small block of the step before is freed.
+$size = $start_size;
+print OUTFILE "a 0 $size\n";
+print OUTFILE "a 1 $small_size\n";
+for ($i = 1;  $i < $num_iters; $i += 1) {
+    $size += $grow_size;
+    $small = $i + 1;
+    $prev = $i;
+    print OUTFILE "r 0 $size\n";
+    print OUTFILE "a $small $small_size\n";
+    print OUTFILE "f $prev\n";
+}
+print OUTFILE "f 0\n";
+
+close OUTFILE;
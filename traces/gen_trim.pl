@@ -0,0 +1,42 @@
+#!/usr/bin/perl
+
+$out_filename = "trim.rep";
+$num_phases = 40;
+$phase_blocks = 5;
+$min_size = 24000;
+$max_size = 31000;
+$live_phases = 2;
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Every phase allocates $phase_blocks blocks just below the mmap threshold,
+# then frees the blocks of the phase $live_phases phases ago. The runner puts
+# a guard page in the break every 5 requests, so the blocks of a phase are
+# allocated back to back and merge into a free block big enough to be given
+# back to the OS once they are all freed.
+srand(429);
+@lines = ();
+for ($i = 0;  $i < $num_phases; $i += 1) {
+    for ($j = 0; $j < $phase_blocks; $j += 1) {
+	$size = $min_size + int(rand ($max_size - $min_size));
+	push @lines, "a " . ($i*$phase_blocks + $j) . " $size";
+    }
+    if ($i >= $live_phases) {
+	for ($j = 0; $j < $phase_blocks; $j += 1) {
+	    push @lines, "f " . (($i - $live_phases)*$phase_blocks + $j);
+	}
+    }
+}
+
+# Calculate misc parameters
+$num_blocks = $num_phases*$phase_blocks;
+$num_ops = scalar @lines;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+foreach $line (@lines) {
+    print OUTFILE "$line\n";
+}
+
+close OUTFILE;
@@ -0,0 +1,114 @@
+#include "uarena.h"
+#include "umalloc.h"
+#include <assert.h>
+
+/*  ~Overall Implementation Information~
+ *  An arena owns a list of chunks, each one a block from umalloc, so arena memory comes
+ *  from the same csbrk backed heap as everything else.
+ *
+ *  Allocating bumps a pointer through the current chunk. When it runs out the next chunk
+ *  in the list that fits is used, and a new chunk is only umalloc'd past the end of the list.
+ *  Requests bigger than UARENA_CHUNK_SIZE get a chunk of their own size.
+ *
+ *  Resetting points the arena back at its first chunk, so the chunks are reused in order
+ *  by the next phase without touching umalloc.
+ */
+
+/*
+ * use_chunk - makes chunk the one the arena bumps through
+ */
+static void use_chunk(uarena_t *arena, uarena_chunk_t *chunk) {
+    arena->current = chunk;
+    arena->bump = (char*) (chunk + 1);
+    arena->limit = arena->bump + chunk->capacity;
+}
+
+/*
+ * uarena_create - creates an empty arena, chunks are only allocated once it is used.
+ */
+uarena_t *uarena_create() {
+    uarena_t *arena = umalloc(sizeof(uarena_t));
+    if(arena == NULL){
+        return NULL;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->bump = NULL;
+    arena->limit = NULL;
+    return arena;
+}
+
+/*
+ * uarena_alloc - carves size bytes out of the arena, aligned to ALIGNMENT.
+ * Returns NULL if no chunk can be umalloc'd for it.
+ */
+void *uarena_alloc(uarena_t *arena, size_t size) {
+    assert(arena != NULL);
+
+    //special case: a size this big would wrap once it is aligned
+    if(size > MAX_REQUEST){
+        return NULL;
+    }
+    size = ALIGN(size);
+
+    //fast path: the current chunk has room
+    if(arena->bump != NULL && size <= (size_t) (arena->limit - arena->bump)){
+        void *ret = arena->bump;
+        arena->bump += size;
+        return ret;
+    }
+
+    //reuses the next chunk from before a reset that fits, chunks that are skipped stay idle until the next reset
+    uarena_chunk_t *prevChunk = arena->current;
+    uarena_chunk_t *chunk = prevChunk == NULL ? arena->first : prevChunk->next;
+    while(chunk != NULL && chunk->capacity < size){
+        prevChunk = chunk;
+        chunk = chunk->next;
+    }
+
+    //else umallocs a new chunk and links it in after the last one used
+    if(chunk == NULL){
+        size_t capacity = size > UARENA_CHUNK_SIZE ? size : UARENA_CHUNK_SIZE;
+        chunk = umalloc(sizeof(uarena_chunk_t) + capacity);
+        if(chunk == NULL){
+            return NULL;
+        }
+        chunk->capacity = capacity;
+        if(prevChunk == NULL){
+            chunk->next = arena->first;
+            arena->first = chunk;
+        } else{
+            chunk->next = prevChunk->next;
+            prevChunk->next = chunk;
+        }
+    }
+
+    use_chunk(arena, chunk);
+    void *ret = arena->bump;
+    arena->bump += size;
+    return ret;
+}
+
+/*
+ * uarena_reset - gives back everything allocated from the arena at once, keeping its chunks.
+ */
+void uarena_reset(uarena_t *arena) {
+    assert(arena != NULL);
+    if(arena->first != NULL){
+        use_chunk(arena, arena->first);
+    }
+}
+
+/*
+ * uarena_destroy - frees every chunk of the arena and the arena itself.
+ */
+void uarena_destroy(uarena_t *arena) {
+    assert(arena != NULL);
+    uarena_chunk_t *chunk = arena->first;
+    while(chunk != NULL){
+        uarena_chunk_t *next = chunk->next;
+        ufree(chunk);
+        chunk = next;
+    }
+    ufree(arena);
+}
@@ -0,0 +1,33 @@
+#include <stdlib.h>
+
+#define UARENA_CHUNK_SIZE (16 * 1024) /* Payload bytes of a regular arena chunk */
+
+/*
+ * uarena_chunk_t - Header of a chunk an arena bumps through. Chunks are
+ * umalloc'd blocks, the header is 16 bytes so the space after it stays
+ * 16 byte aligned.
+ */
+typedef struct uarena_chunk_struct {
+    //next chunk in order of use
+    struct uarena_chunk_struct *next;
+
+    //bytes available after the header
+    size_t capacity;
+} uarena_chunk_t;
+
+/*
+ * uarena_t - A bump pointer arena. Objects are carved one after the other out
+ * of the current chunk and are only given back all at once by uarena_reset
+ * or uarena_destroy. Chunks are kept across resets and reused in order.
+ */
+typedef struct {
+    uarena_chunk_t *first;
+    uarena_chunk_t *current;
+    char *bump;
+    char *limit;
+} uarena_t;
+
+uarena_t *uarena_create();
+void *uarena_alloc(uarena_t *arena, size_t size);
+void uarena_reset(uarena_t *arena);
+void uarena_destroy(uarena_t *arena);
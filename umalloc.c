@@ -1,20 +1,76 @@
+#define _GNU_SOURCE
 #include "umalloc.h"
 #include "csbrk.h"
 #include "ansicolors.h"
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <assert.h>
+#ifdef UMALLOC_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//Largest block the heap can serve, csbrk refuses to extend the heap by more than CSBRK_LIMIT
+#define MAX_HEAP_REQUEST (CSBRK_LIMIT - (PAGESIZE/2) - REGION_OVERHEAD)
 
 const char author[] = ANSI_BOLD ANSI_COLOR_RED "Danica Padlan - dmp3357" ANSI_RESET;
 
 /*  ~Overall Implementation Information~
- *  The free blocks are in a double-linked list with pointers to the prev and next block.
- *  The free list is sorted in ascending memory address order.
+ *  The free blocks are kept in segregated free lists, one double-linked list per size class.
+ *  Small sizes (up to SMALL_CLASS_LIMIT) get one class per 16 bytes, larger sizes get one class
+ *  per power of two. Blocks are pushed on the front of their class list, the lists are unordered.
+ *  A bitmap has one bit set for every size class whose list is non-empty.
+ *
+ *  When allocating, the bitmap is used to jump straight to the first size class that can hold
+ *  the request, and only that class is walked for the first fitting block. A split hands out the
+ *  tail of a free block and keeps its front free, except for a block the heap was just extended for:
+ *  it hands out its front so the leftover stays at the top and merges with the next extension.
+ *
+ *  Built with -DUMALLOC_DEFER_COALESCE, freed blocks up to QUICK_LIMIT skip coalescing: they stay
+ *  marked allocated on a quick list per size and are handed out again to requests of exactly their
+ *  size. consolidate merges them all into the heap once QUICK_MAX of them pile up or no free block
+ *  can serve a request.
+ *
+ *  Built with -DUMALLOC_BEST_FIT, free blocks bigger than SMALL_CLASS_LIMIT are kept in a splay tree
+ *  keyed by size instead of the power of two classes, with the tree links stored inside the blocks,
+ *  and allocation takes the smallest block that fits in O(log n) amortized.
+ *
+ *  Free blocks carry a footer (a copy of their size in the last word of the block), and every
+ *  header has a prev free bit telling whether the block physically before it is free. Freeing
+ *  a block finds both physical neighbors from its own header in constant time and merges them.
+ *
+ *  Requests up to SLAB_LIMIT are served from slabs in front of the heap once their size has been asked
+ *  for often enough: page sized runs of equally sized objects without headers, with a bitmap of free
+ *  objects per slab. Slabs live in one reserved range of address space, so ufree tells a slab object
+ *  from a heap payload with a range check and finds its slab by masking the address.
+ *
+ *  Built with -DUMALLOC_THREADS, umalloc and ufree are thread safe: small blocks go through a
+ *  per-thread cache instead of slabs, and the heap below is split in arenas that each have their own
+ *  lock, so threads on different CPUs allocate from different arenas. Allocated blocks carry the id
+ *  of their arena in their header and are freed back to it.
+ *  A small block freed by another thread than the one that allocated it goes back to its owner's
+ *  cache through a lock free list.
+ *
+ *  Built with -DUMALLOC_CHECK_FREE, a shadow bitmap with one bit per 16 byte granule above the initial
+ *  break marks where handed out heap payloads start, so ufree accepts a heap payload in O(1) with one bit.
+ *  Pointers without a bit must start a region cmmap still holds.
  *
- *  When allocating, delinks the allocated block and adjusts its prev and next block to point to each other
- *  Allocater finds and returns first fitting block for requested size.
+ *  Built with -DUMALLOC_HARDEN, every payload is framed by guard words that ufree checks, freed payloads
+ *  are poisoned and held back in a small FIFO quarantine, and are checked again before they are reused.
  *
- *  When freeing block, inserts block in free list in accordance to memory address and
- *  checks for neighboring blocks to coalesce with
+ *  Requests above mmap_threshold bypass the heap: each gets its own private mapping holding a single
+ *  block marked with the mmapped bit, which ufree gives straight back with munmap.
+ *
+ *  Memory goes back to the OS once a freed block grows past TRIM_THRESHOLD: the top of the heap is
+ *  given back with a negative csbrk when the block sits right below the break, else the whole pages
+ *  inside the block are dropped with cmadvise.
+ *
+ *  Allocated blocks only carry an 8 byte header, the list links of free blocks live in their payload.
+ *  Blocks therefore start 8 bytes before a 16 byte boundary, every region begins with an 8 byte pad
+ *  and ends in an allocated epilogue header of size 0 so a block's physical next neighbor can always
+ *  be read without leaving the region.
  */
 
 /*
@@ -22,11 +78,65 @@ const char author[] = ANSI_BOLD ANSI_COLOR_RED "Danica Padlan - dmp3357" ANSI_RE
  * struct, they can be adjusted as necessary.
  */
 
-//A sample pointer to the start of the free list.
-memory_block_t *free_head; 
-
-//Keeps track of last free block
-memory_block_t *last_free;
+//Every heap, and the one the calling thread works on, which it must hold the lock of in thread safe mode
+arena_t arenas[NUM_ARENAS];
+#ifdef UMALLOC_THREADS
+static __thread arena_t *arena;
+
+//Guards the program break, which every arena grows and shrinks its regions at
+static pthread_mutex_t break_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static arena_t *arena = &arenas[0];
+#endif
+
+#ifndef UMALLOC_THREADS
+//Reserved range of slabs, pages below slab_top are slabs, pages below slab_committed are usable memory
+char *slab_base;
+char *slab_top;
+char *slab_committed;
+
+//Slabs with free objects, one list per slab class, and slabs without any object in use
+slab_t *partial_slabs[NUM_SLAB_CLASSES];
+slab_t *empty_slabs;
+
+//Requests each slab class has seen, a class only gets slabs once it had SLAB_WARMUP of them
+uint32_t slab_requests[NUM_SLAB_CLASSES];
+#endif
+
+//Block sizes above this are served by their own mapping instead of the heap
+size_t mmap_threshold = MMAP_THRESHOLD;
+
+#ifdef UMALLOC_CHECK_FREE
+//Bitmap of heap payloads handed out, bit i stands for the granule ALIGNMENT * i bytes above shadow_base
+static uint64_t *shadow_map;
+static char *shadow_base;
+//Highest break csbrk handed out since uinit, the bitmap is only written below it
+static char *shadow_top;
+#endif
+
+#ifdef UMALLOC_HARDEN
+//Freed payloads not given back yet, a ring of QUARANTINE_SIZE with the oldest at quarantine_head
+static char *quarantine[QUARANTINE_SIZE];
+static size_t quarantine_head;
+static size_t quarantine_count;
+static size_t quarantine_bytes;
+#ifdef UMALLOC_THREADS
+static pthread_mutex_t quarantine_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#endif
+
+#ifdef UMALLOC_NO_STATS
+#define STAT_ADD(counter, n)
+#define STAT_ADD_SHARED(counter, n)
+#else
+//Counters the arena or break lock guards are plain adds, mapping counters are updated without a lock
+#define STAT_ADD(counter, n) ((counter) += (n))
+#define STAT_ADD_SHARED(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+
+//Calls to csbrk and bytes of mmapped blocks since uinit
+size_t stat_csbrk_calls;
+size_t stat_mmap_bytes;
+#endif
 
 /* 
  * is_allocated - returns true if a block is marked as allocated.
@@ -57,41 +167,156 @@ void deallocate(memory_block_t *block) {
  */
 size_t get_size(memory_block_t *block) {
     assert(block != NULL);
-    return block->block_size_alloc & ~(ALIGNMENT-1);
+    return block->block_size_alloc & SIZE_MASK;
+}
+
+/* 
+ * set_size - changes the size of a block, keeping its other header bits.
+ */
+void set_size(memory_block_t *block, size_t size) {
+    assert(block != NULL);
+    assert((size & ~SIZE_MASK) == 0);
+    block->block_size_alloc = size | (block->block_size_alloc & ~SIZE_MASK);
+}
+
+/* 
+ * is_prev_free - returns true if the block physically before this one is free.
+ */
+bool is_prev_free(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & PREV_FREE;
+}
+
+/* 
+ * set_prev_free - sets or clears the prev free bit of a block.
+ */
+void set_prev_free(memory_block_t *block, bool prev_free) {
+    assert(block != NULL);
+    if(prev_free){
+        block->block_size_alloc |= PREV_FREE;
+    } else{
+        block->block_size_alloc &= ~PREV_FREE;
+    }
+}
+
+/* 
+ * is_zeroed - returns true if the payload of a block is known to be zero, apart from
+ * the link and footer words a free block keeps in it.
+ */
+bool is_zeroed(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & ZEROED;
+}
+
+/* 
+ * set_zeroed - sets or clears the known zero bit of a block.
+ */
+void set_zeroed(memory_block_t *block, bool zeroed) {
+    assert(block != NULL);
+    if(zeroed){
+        block->block_size_alloc |= ZEROED;
+    } else{
+        block->block_size_alloc &= ~ZEROED;
+    }
+}
+
+/* 
+ * is_mmapped - returns true if a block lives in its own mapping instead of the heap.
+ */
+bool is_mmapped(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & MMAPPED;
+}
+
+/* 
+ * set_arena - stamps the id of the arena an allocated block belongs to in its header.
+ */
+static void set_arena(memory_block_t *block, size_t id) {
+    block->block_size_alloc = (block->block_size_alloc & (((size_t) 1 << ARENA_SHIFT) - 1)) | (id << ARENA_SHIFT);
+}
+
+/* 
+ * lock_break - takes the lock of the program break in thread safe mode, csbrk is shared by every arena.
+ */
+static void lock_break() {
+#ifdef UMALLOC_THREADS
+    pthread_mutex_lock(&break_lock);
+#endif
+}
+
+/* 
+ * unlock_break - releases the lock taken by lock_break.
+ */
+static void unlock_break() {
+#ifdef UMALLOC_THREADS
+    pthread_mutex_unlock(&break_lock);
+#endif
+}
+
+/* 
+ * lock_maps - takes the lock of the program break when frees are checked in thread safe mode,
+ * the index of mapped regions csbrk keeps for the checks is shared by every thread.
+ */
+static void lock_maps() {
+#ifdef UMALLOC_CHECK_FREE
+    lock_break();
+#endif
+}
+
+/* 
+ * unlock_maps - releases the lock taken by lock_maps.
+ */
+static void unlock_maps() {
+#ifdef UMALLOC_CHECK_FREE
+    unlock_break();
+#endif
+}
+
+/* 
+ * get_footer - gets the footer word in the last 8 bytes of a free block.
+ */
+size_t *get_footer(memory_block_t *block) {
+    assert(block != NULL);
+    return (size_t *)((char *) block + get_size(block)) - 1;
 }
 
 /* 
  * put_block - puts a block struct into memory at the specified address.
- * Initializes the size and allocated fields, along with NUlling out the next 
- * and prev field.
+ * Initializes the size and allocated fields with the prev free and known zero bits cleared.
+ * Free blocks also get their next and prev field NULLed out and their footer,
+ * allocated blocks keep their payload untouched.
  */
 void put_block(memory_block_t *block, size_t size, bool alloc) {
     assert(block != NULL);
     assert(size % ALIGNMENT == 0);
     assert(alloc >> 1 == 0);
     block->block_size_alloc = size | alloc;
-    block->next = NULL; 
-    block->prev = NULL;
+    if(!alloc){
+        block->next = NULL; 
+        block->prev = NULL;
+        *get_footer(block) = size;
+    }
 }
 
 /* 
- * get_payload - gets the payload of the block. (Revised to support 32 byte header)
+ * get_payload - gets the payload of the block. (Revised to support 8 byte header)
  */
 void *get_payload(memory_block_t *block) {
     assert(block != NULL);
 
-    //returns payload address (address of where to start putting storage)
-    return (void*)(block + 1);
+    //returns payload address (address of where to start putting storage),
+    //free blocks keep their prev and next pointers here
+    return (void*)((char*) block + HEADER_SIZE);
 }
 
 /* 
- * get_block - given a payload, returns the block. (Revised to support 32 byter header)
+ * get_block - given a payload, returns the block. (Revised to support 8 byte header)
  */
 memory_block_t *get_block(void *payload) {
     assert(payload != NULL);
 
-    //returns address of header (holds block_size_alloc, prev, and next information)
-    return ((memory_block_t *)payload) - 1;
+    //returns address of header (holds block_size_alloc information)
+    return (memory_block_t *)((char*) payload - HEADER_SIZE);
 }
 
 /* 
@@ -100,100 +325,283 @@ memory_block_t *get_block(void *payload) {
  */
 
 /* 
- * insert - finds spot to insert block in ascending order in accordance to memory address
+ * get_class - returns the size class a block of the given size belongs to.
+ * Sizes up to SMALL_CLASS_LIMIT get one class per ALIGNMENT bytes, larger sizes
+ * get one class per power of two.
  */
-void insert(memory_block_t* curBlock){
-    //pre-condition: curBlock cannot be NULL
-    assert(curBlock != NULL);
+size_t get_class(size_t size) {
+    assert(size > 0);
 
-    //special case: free list is empty
-    if(free_head == NULL){
+    //small sizes map directly to a 16 byte wide class
+    if(size <= SMALL_CLASS_LIMIT){
+        return (size / ALIGNMENT) - 1;
+    }
 
-        //updates curBlock to free_head and last_free
-        free_head = curBlock;
-        last_free = free_head;
+    //large sizes are binned by their highest set bit, the first large class
+    //starts right after SMALL_CLASS_LIMIT (2^9)
+    size_t sizeClass = NUM_SMALL_CLASSES + (63 - __builtin_clzl(size)) - 9;
+    return sizeClass < NUM_CLASSES ? sizeClass : NUM_CLASSES - 1;
+}
 
-        //nulls out prev and next pointers since curBlock is the only block in the list
-        free_head->prev = NULL;
-        free_head->next = NULL;
-        return;
-    } 
+/* 
+ * get_next - returns the block physically after the given block. Every region
+ * ends with an epilogue, so the result is always a readable header.
+ */
+memory_block_t *get_next(memory_block_t *block) {
+    assert(block != NULL);
+    return (memory_block_t *)((char *) block + get_size(block));
+}
 
-    //special case: curBlock address is less than free_head
-    if(curBlock < free_head){
+/* 
+ * get_prev - returns the block physically before the given block by reading its footer.
+ * Only valid when the prev free bit of block is set.
+ */
+memory_block_t *get_prev(memory_block_t *block) {
+    assert(block != NULL && is_prev_free(block));
+    size_t prevSize = *((size_t *) block - 1);
+    return (memory_block_t *)((char *) block - prevSize);
+}
 
-        //set old freehead's prev to curblock
-        free_head->prev = curBlock;
+/* 
+ * put_epilogue - writes the allocated, size 0 header that terminates a region.
+ * Only block_size_alloc is written since the epilogue is HEADER_SIZE bytes.
+ */
+void put_epilogue(memory_block_t *block, bool prev_free) {
+    assert(block != NULL);
+    block->block_size_alloc = 0x1;
+    set_prev_free(block, prev_free);
+    arena->heap_end = block;
+}
 
-        //set curBlock's next to free head and prev to NULL 
-        curBlock->next = free_head;
-        curBlock->prev = NULL;
+#ifdef UMALLOC_BEST_FIT
+/*
+ * get_node - returns the tree links of a large free block
+ */
+static tree_node_t *get_node(memory_block_t *block) {
+    return (tree_node_t*) block;
+}
 
-        //set new free_head to put curBlock as first block in list
-        free_head = curBlock;
-        return;
+/*
+ * tree_splay - top-down splay of the tree rooted at root by size. Returns the new root, the
+ * node of that size if there is one, else the last node on the search path, so the new root
+ * is the biggest node smaller than size or the smallest node bigger than it.
+ */
+static memory_block_t *tree_splay(memory_block_t *root, size_t size) {
+    if(root == NULL){
+        return NULL;
     }
 
-    //special case: address greater than last_free
-    if(curBlock > last_free){
+    //nodes smaller than size are hung on the right spine of leftTree, bigger ones on the left spine of rightTree
+    tree_node_t assembly = { .left = NULL, .right = NULL };
+    tree_node_t* leftTree = &assembly;
+    tree_node_t* rightTree = &assembly;
+    tree_node_t* node = get_node(root);
+    while(size != get_size(&node->block)){
+        if(size < get_size(&node->block)){
+            if(node->left == NULL){
+                break;
+            }
+
+            //zig-zig case, rotates right first
+            if(size < get_size(node->left)){
+                tree_node_t* child = get_node(node->left);
+                node->left = child->right;
+                child->right = &node->block;
+                node = child;
+                if(node->left == NULL){
+                    break;
+                }
+            }
+            rightTree->left = &node->block;
+            rightTree = node;
+            node = get_node(node->left);
+        } else{
+            if(node->right == NULL){
+                break;
+            }
 
-        //set old last_free's next to curBlock
-        last_free->next = curBlock;
+            //zig-zig case, rotates left first
+            if(size > get_size(node->right)){
+                tree_node_t* child = get_node(node->right);
+                node->right = child->left;
+                child->left = &node->block;
+                node = child;
+                if(node->right == NULL){
+                    break;
+                }
+            }
+            leftTree->right = &node->block;
+            leftTree = node;
+            node = get_node(node->right);
+        }
+    }
 
-        //sets curBlock's prev to last_free and next to NULL
-        curBlock->prev = last_free;
-        curBlock->next = NULL;
+    //reassembles the node with the two side trees as its children
+    leftTree->right = node->left;
+    rightTree->left = node->right;
+    node->left = assembly.right;
+    node->right = assembly.left;
+    return &node->block;
+}
 
-        //sets new last_free to put curBlock last in list
-        last_free = curBlock;
+/*
+ * tree_insert - adds a large free block to the tree, or to the list of the node of its size
+ */
+static void tree_insert(memory_block_t *block) {
+    size_t size = get_size(block);
+    tree_node_t* node = get_node(block);
+    arena->free_tree = tree_splay(arena->free_tree, size);
+
+    //special case: a node of this size exists, the block joins its list
+    if(arena->free_tree != NULL && get_size(arena->free_tree) == size){
+        block->prev = arena->free_tree;
+        block->next = arena->free_tree->next;
+        if(block->next != NULL){
+            block->next->prev = block;
+        }
+        arena->free_tree->next = block;
         return;
     }
 
-    //general case: inserts in middle of list, prev and next are non-NULL blocks
-    //arithmetic determines which end of list to start in
-    //if curBlock is closer to free_head (aka curBlock - free_head) < (last_free - curBlock) then start looking at free_head
-    //if curBlock is closer to last_free (aka curBlock - free_head) > (last_free - curBlock) then start looking at last_free
-    memory_block_t* curMemory = (curBlock - free_head) < (last_free - curBlock) ? free_head : last_free;
+    //else the block becomes the root, taking the side of the old root it belongs on
+    block->prev = NULL;
+    block->next = NULL;
+    node->left = NULL;
+    node->right = NULL;
+    if(arena->free_tree != NULL){
+        tree_node_t* oldRoot = get_node(arena->free_tree);
+        if(size < get_size(arena->free_tree)){
+            node->left = oldRoot->left;
+            node->right = arena->free_tree;
+            oldRoot->left = NULL;
+        } else{
+            node->right = oldRoot->right;
+            node->left = arena->free_tree;
+            oldRoot->right = NULL;
+        }
+    }
+    arena->free_tree = block;
+}
+
+/*
+ * tree_remove - takes a large free block out of the tree. Its tree links are cleared so
+ * the only words a free block leaves in its payload are still its list links and footer.
+ */
+static void tree_remove(memory_block_t *block) {
+    tree_node_t* node = get_node(block);
 
-    //traverses blocks from the beginning of free list
-    if(curMemory == free_head){
-        while(curMemory && curMemory->next != NULL){
+    //special case: the block is in the list of a node, not a node itself
+    if(block->prev != NULL){
+        block->prev->next = block->next;
+        if(block->next != NULL){
+            block->next->prev = block->prev;
+        }
+    } else{
+        //brings the block to the root, then replaces it with the next block of its size,
+        //or with the biggest node of its left subtree, which has no right child once splayed up
+        arena->free_tree = tree_splay(arena->free_tree, get_size(block));
+        assert(arena->free_tree == block);
+        if(block->next != NULL){
+            tree_node_t* successor = get_node(block->next);
+            block->next->prev = NULL;
+            successor->left = node->left;
+            successor->right = node->right;
+            arena->free_tree = block->next;
+        } else if(node->left == NULL){
+            arena->free_tree = node->right;
+        } else{
+            arena->free_tree = tree_splay(node->left, get_size(block));
+            get_node(arena->free_tree)->right = node->right;
+        }
+    }
+    block->next = NULL;
+    block->prev = NULL;
+    node->left = NULL;
+    node->right = NULL;
+}
 
-            //checking for addresses to be inserted between
-            if(curMemory < curBlock && curBlock < curMemory->next){
+/*
+ * tree_find - returns the smallest free block in the tree of at least size bytes, or NULL
+ */
+static memory_block_t *tree_find(size_t size) {
+    arena->free_tree = tree_splay(arena->free_tree, size);
+    if(arena->free_tree == NULL || get_size(arena->free_tree) >= size){
+        return arena->free_tree;
+    }
 
-                //insert in between the two blocks, changes curMemory's next prev 
-                //and curBlock's next to each other
-                curMemory->next->prev = curBlock;
-                curBlock->next = curMemory->next;
+    //the root is the biggest node that is too small, the answer is the smallest node right of it
+    memory_block_t* cur = get_node(arena->free_tree)->right;
+    while(cur != NULL && get_node(cur)->left != NULL){
+        cur = get_node(cur)->left;
+    }
+    return cur;
+}
+#endif
 
-                //changes curMemory's next and curBlock's prev to each other
-                curMemory->next = curBlock;
-                curBlock->prev = curMemory;
-                return;
-            }
-            curMemory = curMemory->next;
-        }
-    } 
+/* 
+ * insert - pushes a free block on the front of its size class list,
+ * in best fit mode blocks bigger than SMALL_CLASS_LIMIT go in the tree instead
+ */
+void insert(memory_block_t* curBlock){
+    //pre-condition: curBlock cannot be NULL
+    assert(curBlock != NULL);
+
+#ifdef UMALLOC_BEST_FIT
+    if(get_size(curBlock) > SMALL_CLASS_LIMIT){
+        tree_insert(curBlock);
+        return;
+    }
+#endif
 
-    //else traverses blocks from the end of free list
-    while(curMemory && curMemory->prev != NULL){
+    size_t sizeClass = get_class(get_size(curBlock));
+    memory_block_t* oldHead = arena->free_lists[sizeClass];
 
-        //checking for addresses to be inserted between
-        if(curMemory->prev < curBlock && curBlock < curMemory){
+    //links curBlock in front of the old head
+    curBlock->prev = NULL;
+    curBlock->next = oldHead;
+    if(oldHead != NULL){
+        oldHead->prev = curBlock;
+    }
 
-            //insert in between the two blocks, changes curMemory's prev next 
-            //and curBlock's prev to each other
-            curMemory->prev->next = curBlock;
-            curBlock->prev = curMemory->prev;
+    //curBlock is the new head, mark the class as non-empty
+    arena->free_lists[sizeClass] = curBlock;
+    arena->free_bitmap |= (1UL << sizeClass);
+}
 
-            //changes curMemory's prev and curBlock's next to each other
-            curMemory->prev = curBlock;
-            curBlock->next = curMemory;
-            return;
+/* 
+ * delink - removes a free block from its size class list, or from the tree in best fit mode
+ */
+void delink(memory_block_t* curBlock){
+    //pre-condition: curBlock cannot be NULL
+    assert(curBlock != NULL);
+
+#ifdef UMALLOC_BEST_FIT
+    if(get_size(curBlock) > SMALL_CLASS_LIMIT){
+        tree_remove(curBlock);
+        return;
+    }
+#endif
+
+    size_t sizeClass = get_class(get_size(curBlock));
+
+    //links neighbors in list to each other
+    if(curBlock->prev != NULL){
+        curBlock->prev->next = curBlock->next;
+    } else{
+
+        //curBlock was the head, clear the class bit if the list is now empty
+        arena->free_lists[sizeClass] = curBlock->next;
+        if(curBlock->next == NULL){
+            arena->free_bitmap &= ~(1UL << sizeClass);
         }
-        curMemory = curMemory->prev;
     }
+    if(curBlock->next != NULL){
+        curBlock->next->prev = curBlock->prev;
+    }
+
+    //dereferences curBlock's next and prev
+    curBlock->next = NULL;
+    curBlock->prev = NULL;
 }
 
 /* 
@@ -201,131 +609,177 @@ void insert(memory_block_t* curBlock){
  */
 memory_block_t *extend(size_t size) {
     //get new heap pool for more memory storage
-    memory_block_t* temp = csbrk(size + (PAGESIZE/2));
+    size_t poolSize = size + (PAGESIZE/2);
+    lock_break();
+    memory_block_t* temp = csbrk(poolSize);
+    STAT_ADD(stat_csbrk_calls, 1);
+#ifdef UMALLOC_CHECK_FREE
+    if(temp != NULL && (char*) temp + poolSize > shadow_top){
+        shadow_top = (char*) temp + poolSize;
+    }
+#endif
+    unlock_break();
+    if(temp == NULL){
+        return NULL;
+    }
+    STAT_ADD(arena->held_bytes, poolSize);
+
+    //if new pool directly follows the last region, the old epilogue becomes the new block's header
+    //and keeps its prev free bit, else the new pool is its own region and needs room for its
+    //own alignment pad and epilogue
+    bool prevFree = false;
+    if((char*) temp == (char*) arena->heap_end + HEADER_SIZE){
+        temp = arena->heap_end;
+        prevFree = is_prev_free(arena->heap_end);
+    } else{
+        temp = (memory_block_t*) ((char*) temp + HEADER_SIZE);
+        poolSize -= REGION_OVERHEAD;
+    }
 
-    //initializing header for new heap pool
-    put_block(temp, size + (PAGESIZE/2), false);
+    //initializing header for new heap pool and closing it with an epilogue,
+    //memory fresh from csbrk is known to be zero
+    put_block(temp, poolSize, false);
+    set_prev_free(temp, prevFree);
+    set_zeroed(temp, true);
+    put_epilogue(get_next(temp), true);
 
-    //insert memory address in free list
-    insert(temp);
-    return temp;
+    //merges with a free block left at the end of the last region and inserts in free list
+    return coalesce(temp);
 }
 
 /* 
- * find - finds a free block that can satisfy the umalloc request by using the first fit algorithm
+ * find - finds a free block that can satisfy the umalloc request by using the first fit
+ * algorithm over the segregated lists. In best fit mode it returns the smallest block that fits.
  */
 memory_block_t *find(size_t size) { 
-    //starts searching in beginning of memory header list
-    memory_block_t* curMemory = free_head;
+    size_t sizeClass = get_class(size);
+
+#ifdef UMALLOC_BEST_FIT
+    //small classes hold a single size, so the first non-empty one from the request's own class is the best fit,
+    //the bitmap only has bits for small classes
+    if(sizeClass < NUM_SMALL_CLASSES){
+        uint64_t fittingClasses = arena->free_bitmap & (~0UL << sizeClass);
+        if(fittingClasses){
+            return arena->free_lists[__builtin_ctzl(fittingClasses)];
+        }
+    }
 
-    //runs loop while curMemory is not null
+    //else the smallest fitting block of the tree
+    memory_block_t* bestBlock = tree_find(size);
+    if(bestBlock != NULL){
+        return bestBlock;
+    }
+#else
+    //walks the request's own class, large classes hold a range of sizes
+    memory_block_t* curMemory = arena->free_lists[sizeClass];
     while(curMemory){
-
-        //checks if block is greater or equal to size AND potential leftover block 
-        //is big enough to store another header and payload addresses to avoid out-of-bounds SEGFAULTS
-        //OR the block fits the requested size permanently 
-        if((get_size(curMemory) > size && (get_size(curMemory) - size) > sizeof(memory_block_t)) 
-            || get_size(curMemory) == size){
+        if(get_size(curMemory) >= size){
             return curMemory;
         }
         curMemory = curMemory->next;
     }
 
+    //any block of a bigger non-empty class fits, jump to the first one with the bitmap
+    uint64_t biggerClasses = (sizeClass + 1 < NUM_CLASSES) ? arena->free_bitmap & (~0UL << (sizeClass + 1)) : 0;
+    if(biggerClasses){
+        return arena->free_lists[__builtin_ctzl(biggerClasses)];
+    }
+#endif
+
+#ifdef UMALLOC_DEFER_COALESCE
+    //blocks held back in the quick lists may merge into one that fits, else they are reused later
+    if(arena->quick_count > 0){
+        consolidate();
+        return find(size);
+    }
+#endif
+
     //special case: no block can hold requested size, must call extend for new block
     return extend(size); 
 }
 
 /* 
- * split - splits a given block in parts, one allocated, one free.
+ * split - splits a given free block in parts, one allocated, one free.
+ * The allocated part is the tail of the block, or its front if front is set.
+ * The block must already be delinked from the free list.
  */
-memory_block_t *split(memory_block_t *block, size_t size) {
+memory_block_t *split(memory_block_t *block, size_t size, bool front) {
     //find size of leftover block after allocating part of the block
     size_t leftoverSize = get_size(block) - size;
+    bool zeroed = is_zeroed(block);
+    STAT_ADD(arena->splits, 1);
+
+    //front case: the leftover stays at the top of the heap
+    if(front){
+        memory_block_t* leftoverBlock = (memory_block_t*) ((char*) block + size);
+        put_block(leftoverBlock, leftoverSize, false);
+        set_zeroed(leftoverBlock, zeroed);
+        insert(leftoverBlock);
+
+        //its prev neighbor is allocated since free blocks are always coalesced,
+        //the epilogue already knows the block before it is free
+        put_block(block, size, true);
+        set_zeroed(block, zeroed);
+        return block;
+    }
 
-    //allocating last splitted portion of the block, keeping first half in free list
+    //allocating last splitted portion of the block, keeping first half free
     //calculates allocating block address
     memory_block_t* allocatedBlock = (memory_block_t*) ((char*) block + leftoverSize);
     
-    //sets leftover block to new size
-    block->block_size_alloc = leftoverSize;
-
-    //sets allocated blocks size and allocated boolean
+    //sets leftover block to new size and puts it back in the list of its new class,
+    //its prev neighbor is allocated since free blocks are always coalesced
+    put_block(block, leftoverSize, false);
+    set_zeroed(block, zeroed);
+    insert(block);
+
+    //sets allocated blocks size and allocated boolean, the block before it is the free leftover,
+    //both halves stay known zero since the old footer is the only metadata word in the tail
     put_block(allocatedBlock, size, true);
+    set_prev_free(allocatedBlock, true);
+    set_zeroed(allocatedBlock, zeroed);
+    set_prev_free(get_next(allocatedBlock), false);
     return allocatedBlock;
 }
 
 /*
- * coalesce - coalesces a free memory block with neighbors
+ * coalesce - coalesces a free memory block that is not in a free list with its
+ * physical neighbors, inserts the merged block and returns it
  */
-void coalesce(memory_block_t *block) {
-    //checking if previous node can merge with block
-    if(block->prev != NULL){
-
-        //pointer arithmetic to find previous neighboring address
-        char* neighborBlock = (char*) block->prev;
-        neighborBlock = neighborBlock + get_size(block->prev);
-
-        //checks if result of pointer arithmetic equals block
-        if(((memory_block_t*) neighborBlock) == block){
-
-            //calculates new size of merged blocks
-            size_t mergeSize = get_size(block->prev) + get_size(block);
-            block->prev->next = block->next;
-
-            //special case: block is last_free
-            if(last_free == block){
-
-                //sets prev block to new last_free
-                last_free = block->prev;
-
-            //else next is not null    
-            } else if(block->next != NULL){
-
-                //links next block to prev block
-                block->next->prev = block->prev;
-            }
-
-            //updates block's new merged size
-            block->prev->block_size_alloc = mergeSize;
-
-            //dereferences block to prev block to update for next check
-            block = block->prev;
-
-        } 
+memory_block_t *coalesce(memory_block_t *block) {
+    size_t mergeSize = get_size(block);
+
+    //a lone block keeps its known zero bit, merging leaves old headers and footers in the payload
+    bool zeroed = is_zeroed(block);
+
+    //checking if next physical neighbor is free, the epilogue never is
+    memory_block_t* nextBlock = get_next(block);
+    if(!is_allocated(nextBlock)){
+        delink(nextBlock);
+        mergeSize += get_size(nextBlock);
+        zeroed = false;
+        STAT_ADD(arena->coalesces, 1);
     }
 
-    //checking for next pointer
-    if(block->next != NULL){
-
-        //pointer arithmetic to find next neighboring address
-        char* neighborBlock = (char*) block;
-        neighborBlock = neighborBlock + get_size(block);
-
-        //checks if next block is a neighbor
-        if(((memory_block_t*) neighborBlock) == block->next){
-
-            //calculates new size of merge block
-            size_t mergeSize = get_size(block) + get_size(block->next);
-
-            //special case: set the next block's prev and next pointers for last_free
-            if(last_free == block->next){
-
-                //sets prev block to last_free
-                last_free = last_free->prev;
+    //checking if previous physical neighbor is free through the prev free bit and its footer
+    if(is_prev_free(block)){
+        block = get_prev(block);
+        delink(block);
+        mergeSize += get_size(block);
+        zeroed = false;
+        STAT_ADD(arena->coalesces, 1);
+    }
 
-            //links next->next block to current block
-            } else if(block->next->next != NULL){
-                block->next->next->prev = block;
-            }
+    //writes merged header and footer, the block before a free block is never free
+    put_block(block, mergeSize, false);
+    set_zeroed(block, zeroed);
 
-            //updates block's next
-            block->next = block->next->next;
+    //tells the next physical block that its neighbor is now free
+    set_prev_free(get_next(block), true);
 
-            //updates block's new merged size
-            block->block_size_alloc = mergeSize;
-        } 
-    }
-    return;
+    //inserts merged block in the list of its class
+    insert(block);
+    return block;
 }
 
 /*
@@ -333,97 +787,1468 @@ void coalesce(memory_block_t *block) {
  * along with allocating initial memory.
  */
 int uinit() {
-    //call csbrk to initialize heap 
-    //sets memory address to free_head
-    free_head = csbrk((ALIGNMENT/2) * PAGESIZE);
+    //empties every size class of every arena, arenas other than the first get their first region
+    //from extend once they are used
+    for(size_t id = 0; id < NUM_ARENAS; id++){
+        arena_t* curArena = &arenas[id];
+        for(size_t i = 0; i < NUM_CLASSES; i++){
+            curArena->free_lists[i] = NULL;
+        }
+        curArena->free_bitmap = 0;
+        curArena->heap_end = NULL;
+#ifdef UMALLOC_BEST_FIT
+        curArena->free_tree = NULL;
+#endif
+#ifdef UMALLOC_DEFER_COALESCE
+        for(size_t i = 0; i < NUM_SMALL_CLASSES; i++){
+            curArena->quick_lists[i] = NULL;
+        }
+        curArena->quick_count = 0;
+#endif
+#ifdef UMALLOC_THREADS
+        pthread_mutex_init(&curArena->lock, NULL);
+#endif
+        curArena->id = id;
+#ifndef UMALLOC_NO_STATS
+        curArena->held_bytes = 0;
+        curArena->splits = 0;
+        curArena->coalesces = 0;
+#endif
+    }
+    arena = &arenas[0];
+#ifndef UMALLOC_NO_STATS
+    stat_csbrk_calls = 0;
+    stat_mmap_bytes = 0;
+#endif
+
+#ifndef UMALLOC_THREADS
+    //forgets every slab, committed pages of the reserved range are reused from its start
+    for(size_t i = 0; i < NUM_SLAB_CLASSES; i++){
+        partial_slabs[i] = NULL;
+        slab_requests[i] = 0;
+    }
+    empty_slabs = NULL;
+    slab_top = slab_base;
+#endif
+#ifdef UMALLOC_CHECK_FREE
+    //the bitmap covers SHADOW_SPAN bytes from the first break, its pages are only backed once written
+    if(shadow_map == NULL){
+        shadow_base = (char*) ((uintptr_t) sbrk(0) & ~((uintptr_t) ALIGNMENT - 1));
+        shadow_map = mmap(NULL, SHADOW_SPAN / ALIGNMENT / 8, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(shadow_map == MAP_FAILED){
+            shadow_map = NULL;
+            return -1;
+        }
 
-    //updates last_free to memory in free_head since lone heap
-    last_free = free_head;
+    //payloads of the old heap are forgotten, only the pages covering it were written
+    } else if(shadow_top > shadow_base){
+        size_t touched = ((shadow_top - shadow_base) / ALIGNMENT / 8 + PAGESIZE - 1) & ~((size_t) PAGESIZE - 1);
+        madvise(shadow_map, touched < SHADOW_SPAN / ALIGNMENT / 8 ? touched : SHADOW_SPAN / ALIGNMENT / 8, MADV_DONTNEED);
+    }
+    shadow_top = shadow_base;
+#endif
+#ifdef UMALLOC_HARDEN
+    //payloads still in the quarantine belong to the old heap
+    quarantine_head = 0;
+    quarantine_count = 0;
+    quarantine_bytes = 0;
+#endif
 
-    //initializing header
-    put_block(free_head, (ALIGNMENT/2) * PAGESIZE, false);
+    //call csbrk to initialize heap 
+    char* heapStart = csbrk((ALIGNMENT/2) * PAGESIZE);
+    STAT_ADD(stat_csbrk_calls, 1);
+    if(heapStart == NULL){
+        return -1;
+    }
+    STAT_ADD(arena->held_bytes, (ALIGNMENT/2) * PAGESIZE);
+#ifdef UMALLOC_CHECK_FREE
+    shadow_top = heapStart + (ALIGNMENT/2) * PAGESIZE;
+#endif
+
+    //initializing header after the alignment pad and epilogue, then inserts the lone block
+    memory_block_t* firstBlock = (memory_block_t*) (heapStart + HEADER_SIZE);
+    put_block(firstBlock, (ALIGNMENT/2) * PAGESIZE - REGION_OVERHEAD, false);
+    set_zeroed(firstBlock, true);
+    put_epilogue(get_next(firstBlock), true);
+    insert(firstBlock);
 
     return 0;
 }
 
 /*
- * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ * get_request_size - turns a requested payload size into a block size,
+ * payload + header size (8 bytes), free blocks need room for links and footer
  */
-void *umalloc(size_t size) {
-    //pre-condition where size must be greater than 0
-    assert(size > 0);
+size_t get_request_size(size_t size) {
+    size_t appSize = ALIGN(size + HEADER_SIZE);
+    return appSize < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : appSize;
+}
 
-    //request for desired size + header size (32 or size of memory_block_t)
-    int appSize = ALIGN(size + sizeof(memory_block_t));
+/*
+ * heap_alloc - takes a block of at least appSize bytes out of the heap and marks it allocated.
+ * In thread safe mode the caller must hold the lock of the current arena.
+ */
+memory_block_t *heap_alloc(size_t appSize) {
+#ifdef UMALLOC_DEFER_COALESCE
+    //a block of exactly this size freed recently is handed out again as is
+    if(appSize <= QUICK_LIMIT && arena->quick_lists[get_class(appSize)] != NULL){
+        memory_block_t* quickBlock = arena->quick_lists[get_class(appSize)];
+        arena->quick_lists[get_class(appSize)] = quickBlock->next;
+        arena->quick_count--;
+        return quickBlock;
+    }
+#endif
 
-    //find returns the address with headers 
+    //find returns the address with headers, the heap grew if the epilogue moved
+    memory_block_t* oldEnd = arena->heap_end;
     memory_block_t* availBlock = find(appSize); 
+    if(availBlock == NULL){
+        return NULL;
+    }
+    delink(availBlock);
 
-    //check for split case
-    if(get_size(availBlock) > appSize){
+    //check for split case, leftover must be able to hold a header and payload
+    if(get_size(availBlock) - appSize >= MIN_BLOCK_SIZE){
 
-        //splits leftover block from allocating block
-        availBlock = split(availBlock, appSize);
+        //splits leftover block from allocating block, a block the heap just grew for is handed
+        //out from its front so the leftover grows with the next extend instead of being left
+        //behind below the new memory
+        availBlock = split(availBlock, appSize, arena->heap_end != oldEnd && get_next(availBlock) == arena->heap_end);
 
-    //if it is not split case   
+    //if it is not split case, the whole block is handed out
     } else{
-
-        //sets up block as allocated
         allocate(availBlock);
+        set_prev_free(get_next(availBlock), false);
+    }
+    set_arena(availBlock, arena->id);
+    return availBlock;
+}
 
-        //special case if allocating free_head
-        if(free_head == availBlock){
-
-            //updates free_head to next block to delink availBlock
-            free_head = free_head->next;
-            free_head->prev = NULL;
-        } 
+/*
+ * heap_free - gives an allocated block back to the heap.
+ * In thread safe mode the caller must hold the lock of the current arena.
+ */
+void heap_free(memory_block_t *block) {
+#ifdef UMALLOC_DEFER_COALESCE
+    //small blocks stay marked allocated on a quick list until the next consolidate
+    if(get_size(block) <= QUICK_LIMIT){
+        size_t sizeClass = get_class(get_size(block));
+        set_zeroed(block, false);
+        block->next = arena->quick_lists[sizeClass];
+        arena->quick_lists[sizeClass] = block;
+        if(++arena->quick_count >= QUICK_MAX){
+            consolidate();
+        }
+        return;
+    }
+#endif
+
+    //turns allocated block to deallocated, the user may have written to it
+    deallocate(block);
+    set_zeroed(block, false);
+
+    //free neighbors that were already big enough to be released only add pages given back before,
+    //so only the block and its smaller free neighbors can hold pages still in use
+    char* newStart = (char*) block;
+    char* newEnd = (char*) get_next(block);
+    if(is_prev_free(block) && get_size(get_prev(block)) < TRIM_THRESHOLD){
+        newStart = (char*) get_prev(block);
+    }
+    if(!is_allocated(get_next(block)) && get_size(get_next(block)) < TRIM_THRESHOLD){
+        newEnd = (char*) get_next(get_next(block));
+    }
 
-        //special case if allocating last_free
-        if(last_free == availBlock){
+    //merges with free neighbors and inserts the block in its class list,
+    //then gives its memory back if it grew big enough
+    block = coalesce(block);
+    if(get_size(block) >= TRIM_THRESHOLD){
+        release(block, newStart, newEnd);
+    }
+}
 
-            //updates last_free to prev block to delink availBlock
-            last_free = availBlock->prev;
-            last_free->next = NULL;
-            availBlock->prev = last_free;
+/*
+ * consolidate - empties the quick lists, merging every block on them with its free neighbors
+ * in one pass and giving memory back like heap_free. Without -DUMALLOC_DEFER_COALESCE there is nothing held back and it does nothing.
+ * In thread safe mode the caller must hold the lock of the current arena.
+ */
+void consolidate() {
+#ifdef UMALLOC_DEFER_COALESCE
+    for(size_t i = 0; i < NUM_SMALL_CLASSES; i++){
+        memory_block_t* block = arena->quick_lists[i];
+        arena->quick_lists[i] = NULL;
+        while(block != NULL){
+            memory_block_t* next = block->next;
+            char* blockEnd = (char*) get_next(block);
+            deallocate(block);
+            memory_block_t* merged = coalesce(block);
+            if(get_size(merged) >= TRIM_THRESHOLD){
+                release(merged, (char*) block, blockEnd);
+            }
+            block = next;
         }
+    }
+    arena->quick_count = 0;
+#endif
+}
 
-        //sets block's prev and next to point to each other if not NULL
-        //to delink availBlock from free list
-        if(availBlock->prev != NULL){
-            availBlock->prev->next = availBlock->next;
-        }
-        if(availBlock->next != NULL){
-            availBlock->next->prev = availBlock->prev;
+/*
+ * release - gives the memory of a large free block back to the OS. A block right below the
+ * break is cut down to the page holding its first MIN_BLOCK_SIZE bytes and the rest of the heap
+ * is given back with a negative csbrk, the new break is page aligned so memory csbrk hands out
+ * later is still zero. Else only the whole pages between the block's links and footer that also
+ * lie in [newStart, newEnd), the part of the block not given back before, are dropped.
+ * In thread safe mode the caller must hold the lock of the current arena.
+ */
+void release(memory_block_t *block, char *newStart, char *newEnd) {
+    uintptr_t pageMask = PAGESIZE - 1;
+
+    //top case: the block is last before an epilogue that sits at the break
+    lock_break();
+    if(get_next(block) == arena->heap_end && (char*) arena->heap_end + HEADER_SIZE == (char*) sbrk(0)){
+        uintptr_t oldBreak = (uintptr_t) arena->heap_end + HEADER_SIZE;
+        uintptr_t newBreak = ((uintptr_t) block + MIN_BLOCK_SIZE + HEADER_SIZE + pageMask) & ~pageMask;
+        if(newBreak >= oldBreak || csbrk(-(intptr_t) (oldBreak - newBreak)) == NULL){
+            unlock_break();
+            return;
         }
+        STAT_ADD(stat_csbrk_calls, 1);
+        unlock_break();
+        STAT_ADD(arena->held_bytes, -(oldBreak - newBreak));
+
+        //shrinks the block in its class list and closes the region with a new epilogue
+        delink(block);
+        put_block(block, newBreak - HEADER_SIZE - (uintptr_t) block, false);
+        put_epilogue(get_next(block), true);
+        insert(block);
+        return;
+    }
+    unlock_break();
+
+    //interior case: whole pages past the links and before the footer hold nothing,
+    //in best fit mode the links of a block in the tree also take its left and right words
+#ifdef UMALLOC_BEST_FIT
+    char* linksEnd = (char*) (get_node(block) + 1);
+#else
+    char* linksEnd = (char*) (block + 1);
+#endif
+    char* dropStart = newStart > linksEnd ? newStart : linksEnd;
+    char* dropEnd = newEnd < (char*) get_footer(block) ? newEnd : (char*) get_footer(block);
+    uintptr_t pagesStart = ((uintptr_t) dropStart + pageMask) & ~pageMask;
+    uintptr_t pagesEnd = (uintptr_t) dropEnd & ~pageMask;
+    if(pagesEnd > pagesStart){
+        cmadvise((void*) pagesStart, pagesEnd - pagesStart);
+    }
+}
 
-        //dereferences availBlock's next and prev
-        availBlock->next = NULL;
-        availBlock->prev = NULL;
+/*
+ * get_payload_size - returns how many bytes of payload a block holds. The size of an
+ * mmapped block is the length of its mapping, which also holds an alignment pad.
+ */
+size_t get_payload_size(memory_block_t *block) {
+    return get_size(block) - (is_mmapped(block) ? REGION_OVERHEAD : HEADER_SIZE);
+}
+
+/*
+ * mmap_alloc - maps a region of its own for a block of at least appSize bytes. The block
+ * starts after an alignment pad, its size is the length of the whole mapping.
+ */
+memory_block_t *mmap_alloc(size_t appSize) {
+    size_t mapSize = (appSize + HEADER_SIZE + PAGESIZE - 1) & ~((size_t) PAGESIZE - 1);
+    lock_maps();
+    char* mapStart = cmmap(mapSize);
+    unlock_maps();
+    if(mapStart == NULL){
+        return NULL;
     }
+    STAT_ADD_SHARED(stat_mmap_bytes, mapSize);
 
-    //returns payload address to user
-    return get_payload(availBlock);  
+    //mapped memory is zero, the header is the only word written
+    memory_block_t* block = (memory_block_t*) (mapStart + HEADER_SIZE);
+    block->block_size_alloc = mapSize | 0x1 | MMAPPED | ZEROED;
+    return block;
 }
 
 /*
- * ufree -  frees the memory payload space pointed to by ptr, which must have been called
- * by a previous call to malloc. 
+ * mmap_free - unmaps the region of an mmapped block.
  */
-void ufree(void *ptr) {
-    //pre-condition: ptr cannot be NULL
-    assert(ptr != NULL);
+void mmap_free(memory_block_t *block) {
+    STAT_ADD_SHARED(stat_mmap_bytes, -get_size(block));
+    lock_maps();
+    cmunmap((char*) block - HEADER_SIZE, get_size(block));
+    unlock_maps();
+}
 
-    //get block address first
-    memory_block_t* curHeader = get_block(ptr);
+/*
+ * mmap_resize - resizes the mapping of an mmapped block to hold at least appSize bytes,
+ * letting the kernel move the pages instead of copying them. Returns the moved block,
+ * or NULL if the mapping cannot be resized.
+ */
+memory_block_t *mmap_resize(memory_block_t *block, size_t appSize) {
+    size_t mapSize = (appSize + HEADER_SIZE + PAGESIZE - 1) & ~((size_t) PAGESIZE - 1);
+    size_t oldSize = get_size(block);
+    lock_maps();
+    char* mapStart = cmremap((char*) block - HEADER_SIZE, oldSize, mapSize);
+    unlock_maps();
+    if(mapStart == NULL){
+        return NULL;
+    }
+    STAT_ADD_SHARED(stat_mmap_bytes, mapSize - oldSize);
 
-    //turns allocated block to deallocated 
-    deallocate(curHeader);
+    //only the size in the header changes, bytes past the old mapping are zero but the payload is not
+    block = (memory_block_t*) (mapStart + HEADER_SIZE);
+    block->block_size_alloc = mapSize | 0x1 | MMAPPED;
+    return block;
+}
 
-    //inserts the block in free list in accordance to memory address
-    insert(curHeader);
+/*
+ * uset_mmap_threshold - sets the block size above which requests get their own mapping.
+ * Capped so every request below it can still be served by a single csbrk.
+ */
+void uset_mmap_threshold(size_t threshold) {
+    mmap_threshold = threshold < MAX_HEAP_REQUEST ? threshold : MAX_HEAP_REQUEST;
+}
 
-    //checks if neighbors can be merged
-    coalesce(curHeader);
+/*
+ * shrink_block - cuts an allocated block down to appSize bytes, giving the tail back
+ * to the heap when it is big enough to be a block of its own.
+ * In thread safe mode the caller must hold the lock of the current arena.
+ */
+void shrink_block(memory_block_t *block, size_t appSize) {
+    size_t leftoverSize = get_size(block) - appSize;
+    if(leftoverSize < MIN_BLOCK_SIZE){
+        return;
+    }
+
+    //the tail becomes an allocated block right after block, then is freed and merged with what follows
+    set_size(block, appSize);
+    memory_block_t* tail = get_next(block);
+    put_block(tail, leftoverSize, true);
+    heap_free(tail);
+}
+
+/*
+ * heap_resize - resizes an allocated block to appSize bytes without copying it elsewhere.
+ * Shrinks in place, grows by absorbing a free next neighbor (extending the heap first when the
+ * block is the last one before the break), or by sliding the payload down into a free prev neighbor.
+ * Returns the resized block, or NULL when the block has to be moved.
+ * In thread safe mode the caller must hold the lock of the current arena.
+ */
+memory_block_t *heap_resize(memory_block_t *block, size_t appSize) {
+    size_t blockSize = get_size(block);
+
+    //shrink case: split off the tail
+    if(appSize <= blockSize){
+        shrink_block(block, appSize);
+        return block;
+    }
+
+    //bytes available in place, the block plus a free next neighbor
+    memory_block_t* nextBlock = get_next(block);
+    size_t availSize = blockSize + (is_allocated(nextBlock) ? 0 : get_size(nextBlock));
+
+    //special case: nothing but the epilogue follows and it sits at the break,
+    //new memory from extend lands right after the block and becomes its free next neighbor
+    memory_block_t* lastBlock = is_allocated(nextBlock) ? block : nextBlock;
+    if(availSize < appSize && appSize - availSize <= MAX_HEAP_REQUEST && get_next(lastBlock) == arena->heap_end 
+        && (char*) arena->heap_end + HEADER_SIZE == (char*) sbrk(0)){
+        if(extend(appSize - availSize) != NULL){
+            nextBlock = get_next(block);
+            availSize = blockSize + (is_allocated(nextBlock) ? 0 : get_size(nextBlock));
+        }
+    }
+
+    //grow case: absorb the free next neighbor
+    if(availSize >= appSize){
+        if(availSize > blockSize){
+            delink(nextBlock);
+            set_size(block, availSize);
+            set_prev_free(get_next(block), false);
+        }
+        shrink_block(block, appSize);
+        return block;
+    }
+
+    //grow case: slide the payload down into a free prev neighbor, taking the free next as well
+    if(is_prev_free(block) && get_size(get_prev(block)) + availSize >= appSize){
+        memory_block_t* prevBlock = get_prev(block);
+        size_t mergeSize = get_size(prevBlock) + availSize;
+        delink(prevBlock);
+        if(availSize > blockSize){
+            delink(nextBlock);
+        }
+        memmove(get_payload(prevBlock), get_payload(block), blockSize - HEADER_SIZE);
+        put_block(prevBlock, mergeSize, true);
+        set_prev_free(get_next(prevBlock), false);
+        set_arena(prevBlock, arena->id);
+        shrink_block(prevBlock, appSize);
+        return prevBlock;
+    }
+
+#ifdef UMALLOC_DEFER_COALESCE
+    //the neighbors may be blocks held back in the quick lists, merges them and tries again
+    if(arena->quick_count > 0){
+        consolidate();
+        return heap_resize(block, appSize);
+    }
+#endif
+
+    //block has to be moved
+    return NULL;
+}
+
+#ifdef UMALLOC_THREADS
+/*
+ * In thread safe mode the heap is split in NUM_ARENAS arenas, each behind its own lock. A thread
+ * works on the arena of the CPU it first allocated on, or the next one round-robin when the CPU is
+ * unknown, and moves to another arena when its own is locked by someone else and that one is not.
+ * Allocated blocks carry the id of their arena in their header, so they are freed to it.
+ *
+ * Every thread also keeps a cache of small blocks, one bin per small size class. Cached blocks stay
+ * marked allocated in their arena. An arena lock is only taken to refill an empty bin, to flush
+ * half of a full bin, and for blocks too big to be cached.
+ *
+ * Each cache has an owner id that it stamps in the header of every block it hands out. A thread
+ * freeing a block owned by another cache pushes it on that cache's remote list with a CAS instead
+ * of keeping it, and the owner takes the whole list at its next umalloc. Blocks therefore go back
+ * to the thread that allocated them without either thread taking a lock.
+ */
+
+//The arena the calling thread allocates from, and the arena the next thread without a CPU id gets
+static __thread arena_t *home_arena;
+static size_t next_arena;
+
+//Guards owner_used
+static pthread_mutex_t owner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//The calling thread's cache of small blocks
+static __thread thread_cache_t thread_cache;
+
+//Blocks freed by other threads, one lock free list per owner id, and which ids are taken.
+//The list of an exited thread's id holds REMOTE_DEAD until the id is taken again, blocks freed to it go straight to their arena.
+#define REMOTE_DEAD ((memory_block_t*) 1)
+static memory_block_t *remote_frees[MAX_OWNERS];
+static bool owner_used[MAX_OWNERS];
+
+//Key whose destructor flushes a thread's cache when the thread exits
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * arena_lock - takes the lock of an arena and makes it the one the heap functions work on
+ */
+static void arena_lock(arena_t *lockArena) {
+    pthread_mutex_lock(&lockArena->lock);
+    arena = lockArena;
+}
+
+/*
+ * arena_unlock - releases the arena locked by arena_lock or arena_lock_home
+ */
+static void arena_unlock() {
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * arena_lock_home - locks the arena the calling thread allocates from. A thread gets an arena
+ * by its CPU the first time, and when its arena is busy it moves to the first other arena it
+ * can lock without waiting, only waiting for its own when every arena is busy.
+ */
+static void arena_lock_home() {
+    if(home_arena == NULL){
+        int cpu = sched_getcpu();
+        size_t id = cpu >= 0 ? (size_t) cpu : __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+        home_arena = &arenas[id % NUM_ARENAS];
+    }
+    if(pthread_mutex_trylock(&home_arena->lock) == 0){
+        arena = home_arena;
+        return;
+    }
+    for(size_t i = 1; i < NUM_ARENAS; i++){
+        arena_t* otherArena = &arenas[(home_arena->id + i) % NUM_ARENAS];
+        if(pthread_mutex_trylock(&otherArena->lock) == 0){
+            home_arena = otherArena;
+            arena = otherArena;
+            return;
+        }
+    }
+    arena_lock(home_arena);
+}
+
+/*
+ * get_arena - returns the arena an allocated block belongs to
+ */
+static arena_t *get_arena(memory_block_t *block) {
+    return &arenas[block->block_size_alloc >> ARENA_SHIFT];
+}
+
+/*
+ * arena_free - gives a block back to its arena, which must be locked unless it is the locked arena
+ * passed in. Returns the arena left locked, so runs of blocks of one arena take its lock once.
+ */
+static arena_t *arena_free(memory_block_t *block, arena_t *lockedArena) {
+    arena_t* blockArena = get_arena(block);
+    if(blockArena != lockedArena){
+        if(lockedArena != NULL){
+            arena_unlock();
+        }
+        arena_lock(blockArena);
+    }
+    heap_free(block);
+    return blockArena;
+}
+
+/*
+ * cache_flush - gives count blocks from the front of a cache bin back to their arenas
+ */
+static void cache_flush(thread_cache_t *cache, size_t bin, unsigned count) {
+    arena_t* lockedArena = NULL;
+    while(count-- > 0 && cache->bins[bin] != NULL){
+        memory_block_t* block = cache->bins[bin];
+        cache->bins[bin] = block->next;
+        cache->counts[bin]--;
+        lockedArena = arena_free(block, lockedArena);
+    }
+    if(lockedArena != NULL){
+        arena_unlock();
+    }
+}
+
+/*
+ * get_owner - returns the owner id in the header of a block, 0 if no cache handed it out
+ */
+static size_t get_owner(memory_block_t *block) {
+    return (block->block_size_alloc >> OWNER_SHIFT) & (MAX_OWNERS - 1);
+}
+
+/*
+ * set_owner - stamps the owner id of a cache in the header of a block it hands out
+ */
+static void set_owner(memory_block_t *block, size_t owner) {
+    block->block_size_alloc = (block->block_size_alloc & ~((size_t) (MAX_OWNERS - 1) << OWNER_SHIFT)) | (owner << OWNER_SHIFT);
+}
+
+/*
+ * cache_take_remote - takes every block other threads freed to the cache off its remote list
+ */
+static memory_block_t *cache_take_remote(thread_cache_t *cache) {
+    return __atomic_exchange_n(&remote_frees[cache->owner], NULL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * remote_free - pushes a block on the remote list of its owner, lock free. When the owner has
+ * exited the block is given back to its arena instead.
+ */
+static void remote_free(memory_block_t *block, size_t owner) {
+    memory_block_t* head = __atomic_load_n(&remote_frees[owner], __ATOMIC_RELAXED);
+    do{
+        if(head == REMOTE_DEAD){
+            arena_free(block, NULL);
+            arena_unlock();
+            return;
+        }
+        block->next = head;
+    } while(!__atomic_compare_exchange_n(&remote_frees[owner], &head, block, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * cache_destroy - pthread key destructor, gives every block of an exiting thread's cache and
+ * remote list back to their arenas, marks the remote list dead and frees its owner id
+ */
+static void cache_destroy(void *arg) {
+    thread_cache_t *cache = arg;
+    for(size_t bin = 0; bin < NUM_SMALL_CLASSES; bin++){
+        if(cache->counts[bin] > 0){
+            cache_flush(cache, bin, cache->counts[bin]);
+        }
+    }
+
+    if(cache->owner != 0){
+        arena_t* lockedArena = NULL;
+        memory_block_t* block = __atomic_exchange_n(&remote_frees[cache->owner], REMOTE_DEAD, __ATOMIC_ACQUIRE);
+        while(block != NULL){
+            memory_block_t* next = block->next;
+            lockedArena = arena_free(block, lockedArena);
+            block = next;
+        }
+        if(lockedArena != NULL){
+            arena_unlock();
+        }
+
+        pthread_mutex_lock(&owner_lock);
+        owner_used[cache->owner] = false;
+        pthread_mutex_unlock(&owner_lock);
+    }
+}
+
+/*
+ * cache_key_create - creates the key used to find the cache to flush on thread exit
+ */
+static void cache_key_create() {
+    pthread_key_create(&cache_key, cache_destroy);
+}
+
+/*
+ * cache_register - sets the cache up to be flushed when its thread exits and gives it a free
+ * owner id. When every id is taken the cache gets none and keeps every block it is freed.
+ */
+static void cache_register(thread_cache_t *cache) {
+    pthread_once(&cache_key_once, cache_key_create);
+    pthread_setspecific(cache_key, cache);
+    cache->registered = true;
+
+    pthread_mutex_lock(&owner_lock);
+    for(size_t owner = 1; owner < MAX_OWNERS; owner++){
+        if(!owner_used[owner]){
+            owner_used[owner] = true;
+            cache->owner = owner;
+
+            //the list of an id that was used before is marked dead, blocks are freed to it again from now on
+            __atomic_store_n(&remote_frees[owner], NULL, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&owner_lock);
+}
+
+/*
+ * cache_free - pushes a small block on the thread's cache, flushing half of the bin
+ * back to their arenas when it is full
+ */
+static void cache_free(memory_block_t *block) {
+    thread_cache_t *cache = &thread_cache;
+    size_t bin = get_class(get_size(block));
+    set_zeroed(block, false);
+    if(!cache->registered){
+        cache_register(cache);
+    }
+
+    if(cache->counts[bin] >= CACHE_BIN_MAX){
+        cache_flush(cache, bin, CACHE_BIN_MAX / 2);
+    }
+    block->next = cache->bins[bin];
+    cache->bins[bin] = block;
+    cache->counts[bin]++;
+}
+/*
+ * cache_alloc - pops a block of at least appSize bytes from the thread's cache,
+ * refilling the bin with CACHE_REFILL blocks from the thread's arena when empty
+ */
+static memory_block_t *cache_alloc(size_t appSize) {
+    thread_cache_t *cache = &thread_cache;
+    size_t bin = get_class(appSize);
+    if(!cache->registered){
+        cache_register(cache);
+    }
+
+    //takes back the blocks other threads freed since the last call, all at once
+    if(cache->owner != 0 && __atomic_load_n(&remote_frees[cache->owner], __ATOMIC_RELAXED) != NULL){
+        memory_block_t* block = cache_take_remote(cache);
+        while(block != NULL){
+            memory_block_t* next = block->next;
+            cache_free(block);
+            block = next;
+        }
+    }
+
+    //refills an empty bin under the lock of the thread's arena
+    if(cache->bins[bin] == NULL){
+        arena_lock_home();
+        for(int i = 0; i < CACHE_REFILL; i++){
+            memory_block_t* block = heap_alloc(appSize);
+            if(block == NULL){
+                break;
+            }
+            block->next = cache->bins[bin];
+            cache->bins[bin] = block;
+            cache->counts[bin]++;
+        }
+        arena_unlock();
+
+        if(cache->bins[bin] == NULL){
+            return NULL;
+        }
+    }
+
+    //pops the front block of the bin and stamps it as the cache's own
+    memory_block_t* block = cache->bins[bin];
+    cache->bins[bin] = block->next;
+    cache->counts[bin]--;
+    set_owner(block, cache->owner);
+    return block;
+}
+
+#else
+/*
+ * Outside of thread safe mode small requests are served from slabs: pages of equally sized objects
+ * that carry no header, carved from one reserved range of address space. ufree tells slab objects
+ * from heap payloads by that range alone. A class is served from the heap until it has seen
+ * SLAB_WARMUP requests, so sizes that are rarely asked for do not each hold a mostly empty page.
+ * Each class keeps a list of its slabs with free objects, a slab that runs empty goes to a list
+ * shared by every class unless it is the last of its class.
+ */
+
+/*
+ * is_slab_object - returns true if ptr was handed out from a slab
+ */
+static bool is_slab_object(void *ptr) {
+    return (char*) ptr >= slab_base && (char*) ptr < slab_top;
+}
+
+/*
+ * get_slab - returns the slab an object lives in
+ */
+static slab_t *get_slab(void *ptr) {
+    return (slab_t*) ((uintptr_t) ptr & ~((uintptr_t) SLAB_SIZE - 1));
+}
+
+/*
+ * get_slab_capacity - returns how many objects of a size fit in a slab
+ */
+static uint32_t get_slab_capacity(size_t objectSize) {
+    return (SLAB_SIZE - SLAB_HEADER_SIZE) / objectSize;
+}
+
+/*
+ * slab_create - takes an empty slab, or a new page past slab_top, for objects of objectSize
+ * bytes and pushes it on the partial list of its class. Returns NULL when the reserved range
+ * is used up.
+ */
+static slab_t *slab_create(size_t objectSize) {
+    slab_t* slab = empty_slabs;
+    if(slab != NULL){
+        empty_slabs = slab->next;
+    } else{
+        //reserves the range on first use, pages are committed as slab_top reaches them
+        if(slab_base == NULL){
+            if((slab_base = cmreserve(SLAB_RESERVE)) == NULL){
+                return NULL;
+            }
+            slab_top = slab_committed = slab_base;
+        }
+        if(slab_top == slab_base + SLAB_RESERVE){
+            return NULL;
+        }
+        if(slab_top == slab_committed){
+            if(cmcommit(slab_committed, SLAB_SIZE) == -1){
+                return NULL;
+            }
+            slab_committed += SLAB_SIZE;
+        }
+        slab = (slab_t*) slab_top;
+        slab_top += SLAB_SIZE;
+    }
+
+    //every object starts out free
+    uint32_t capacity = get_slab_capacity(objectSize);
+    for(size_t i = 0; i < SLAB_MAP_WORDS; i++){
+        size_t bits = capacity > 64 * i ? capacity - 64 * i : 0;
+        slab->free_map[i] = bits >= 64 ? ~0UL : (1UL << bits) - 1;
+    }
+    slab->object_size = objectSize;
+    slab->num_free = capacity;
+
+    size_t slabClass = objectSize / ALIGNMENT - 1;
+    slab->prev = NULL;
+    slab->next = partial_slabs[slabClass];
+    if(slab->next != NULL){
+        slab->next->prev = slab;
+    }
+    partial_slabs[slabClass] = slab;
+    return slab;
+}
+
+/*
+ * slab_unlink - takes a slab off the partial list of its class
+ */
+static void slab_unlink(slab_t *slab) {
+    size_t slabClass = slab->object_size / ALIGNMENT - 1;
+    if(slab->prev != NULL){
+        slab->prev->next = slab->next;
+    } else{
+        partial_slabs[slabClass] = slab->next;
+    }
+    if(slab->next != NULL){
+        slab->next->prev = slab->prev;
+    }
+}
+
+/*
+ * slab_alloc - hands out the first free object of a slab of the class of objectSize, which must be
+ * a multiple of ALIGNMENT no bigger than SLAB_LIMIT. Returns NULL while the class is not hot enough
+ * to pay for a page of its own yet, or when no slab can be created.
+ */
+static void *slab_alloc(size_t objectSize) {
+    size_t slabClass = objectSize / ALIGNMENT - 1;
+    if(slab_requests[slabClass] < SLAB_WARMUP){
+        slab_requests[slabClass]++;
+        return NULL;
+    }
+    slab_t* slab = partial_slabs[slabClass];
+    if(slab == NULL && (slab = slab_create(objectSize)) == NULL){
+        return NULL;
+    }
+
+    //a partial slab has a set bit in one of its words
+    size_t word = 0;
+    while(slab->free_map[word] == 0){
+        word++;
+    }
+    size_t index = 64 * word + __builtin_ctzl(slab->free_map[word]);
+    slab->free_map[word] &= slab->free_map[word] - 1;
+
+    //a full slab leaves the partial list until one of its objects is freed
+    if(--slab->num_free == 0){
+        slab_unlink(slab);
+    }
+    return (char*) slab + SLAB_HEADER_SIZE + index * slab->object_size;
+}
+
+/*
+ * slab_free - gives an object back to its slab
+ */
+static void slab_free(void *ptr) {
+    slab_t* slab = get_slab(ptr);
+    size_t index = ((char*) ptr - (char*) slab - SLAB_HEADER_SIZE) / slab->object_size;
+    assert((slab->free_map[index / 64] & (1UL << (index % 64))) == 0);
+    slab->free_map[index / 64] |= 1UL << (index % 64);
+
+    //a full slab goes back on the partial list of its class
+    size_t slabClass = slab->object_size / ALIGNMENT - 1;
+    if(++slab->num_free == 1){
+        slab->prev = NULL;
+        slab->next = partial_slabs[slabClass];
+        if(slab->next != NULL){
+            slab->next->prev = slab;
+        }
+        partial_slabs[slabClass] = slab;
+    }
+
+    //an empty slab can be taken by any class, unless its class has no other partial slab
+    if(slab->num_free == get_slab_capacity(slab->object_size)
+        && (partial_slabs[slabClass] != slab || slab->next != NULL)){
+        slab_unlink(slab);
+        slab->next = empty_slabs;
+        empty_slabs = slab;
+    }
+}
+#endif
+
+#ifdef UMALLOC_CHECK_FREE
+/*
+ * The shadow bitmap has a bit for every ALIGNMENT bytes of the SHADOW_SPAN bytes above the initial
+ * break, which the csbrk regions lie in. The bit of a heap payload is set while it is handed out,
+ * from alloc_block until ufree, so ufree and urealloc find out in O(1) and without a lock that a
+ * pointer with its bit set is a live payload. Bits are cleared when payloads are freed, before their
+ * pages can be trimmed, so no other pointer has one. Blocks in thread caches and quick lists are
+ * free to the user and have no bit. Slab objects are checked against the free bitmap of their slab
+ * instead, and pointers without a bit must start a mapped payload: sit right after the pad and
+ * header at the start of a region in the cmmap index, with the mmapped bit set. The header is only
+ * read once the region is found, so a mapping already given back is never touched. Mapped regions
+ * are placed anywhere, also between the initial break and SHADOW_SPAN above.
+ * In thread safe mode arenas may share a word of the bitmap, its bits are tested, set and cleared
+ * atomically, and the cmmap index is only used under the lock of the program break.
+ */
+
+/*
+ * shadow_granule - returns the index of the bit of a pointer into the heap, or SIZE_MAX when the
+ * pointer is outside the bitmap or not aligned
+ */
+static size_t shadow_granule(void *ptr) {
+    uintptr_t offset = (uintptr_t) ptr - (uintptr_t) shadow_base;
+    if((char*) ptr < shadow_base || offset >= SHADOW_SPAN || offset % ALIGNMENT != 0){
+        return SIZE_MAX;
+    }
+    return offset / ALIGNMENT;
+}
+
+/*
+ * shadow_mark - sets the bit of a heap payload being handed out
+ */
+static void shadow_mark(void *payload) {
+    size_t granule = shadow_granule(payload);
+#ifdef UMALLOC_THREADS
+    __atomic_fetch_or(&shadow_map[granule / 64], 1UL << (granule % 64), __ATOMIC_RELAXED);
+#else
+    shadow_map[granule / 64] |= 1UL << (granule % 64);
+#endif
+}
+
+/*
+ * shadow_test - returns whether the bit of a heap payload is set
+ */
+static bool shadow_test(size_t granule) {
+#ifdef UMALLOC_THREADS
+    return (__atomic_load_n(&shadow_map[granule / 64], __ATOMIC_RELAXED) >> (granule % 64)) & 0x1;
+#else
+    return (shadow_map[granule / 64] >> (granule % 64)) & 0x1;
+#endif
+}
+
+/*
+ * shadow_clear - clears the bit of a heap payload given back, returns false if it was not set
+ */
+static bool shadow_clear(size_t granule) {
+    uint64_t bit = 1UL << (granule % 64);
+#ifdef UMALLOC_THREADS
+    return (__atomic_fetch_and(&shadow_map[granule / 64], ~bit, __ATOMIC_RELAXED) & bit) != 0;
+#else
+    bool wasSet = (shadow_map[granule / 64] & bit) != 0;
+    shadow_map[granule / 64] &= ~bit;
+    return wasSet;
+#endif
+}
+
+/*
+ * check_payload - returns whether ptr is a live payload, clearing its bit when taken is set
+ * because it is being freed. Reports the pointer on stderr when it is not.
+ */
+static bool check_payload(void *ptr, bool taken) {
+    bool valid;
+#ifndef UMALLOC_THREADS
+    if(is_slab_object(ptr)){
+        //the pointer must start an object of its slab that is not free
+        slab_t* slab = get_slab(ptr);
+        uintptr_t offset = (uintptr_t) ptr - (uintptr_t) slab - SLAB_HEADER_SIZE;
+        size_t index = offset / slab->object_size;
+        valid = (char*) ptr >= (char*) slab + SLAB_HEADER_SIZE && offset % slab->object_size == 0
+            && index < get_slab_capacity(slab->object_size) && (slab->free_map[index / 64] & (1UL << (index % 64))) == 0;
+    } else
+#endif
+    {
+        //a set bit is only ever found on a live heap payload, anything else may still be a mapped
+        //payload, which can also lie in the bitmap's span
+        size_t granule = shadow_granule(ptr);
+        valid = granule != SIZE_MAX && (taken ? shadow_clear(granule) : shadow_test(granule));
+        if(!valid){
+            lock_break();
+            valid = ((uintptr_t) ptr & (PAGESIZE - 1)) == REGION_OVERHEAD && cmmap_starts((char*) ptr - REGION_OVERHEAD)
+                && is_mmapped(get_block(ptr));
+            unlock_break();
+        }
+    }
+    if(!valid){
+        fprintf(stderr, "umalloc: %p is not an allocated payload, ignored\n", ptr);
+    }
+    return valid;
+}
+#endif
+
+/*
+ * alloc_block - takes an allocated block of at least appSize bytes from the thread's cache
+ * or the heap. The known zero bit of the block is still valid and must be cleared by the caller.
+ */
+memory_block_t *alloc_block(size_t appSize) {
+    memory_block_t* availBlock;
+
+    //large requests get a mapping of their own
+    if(appSize > mmap_threshold){
+        return mmap_alloc(appSize);
+    }
+
+#ifdef UMALLOC_THREADS
+    //small requests are served from the thread's cache, others from the thread's arena under its lock
+    if(appSize <= CACHE_LIMIT){
+        availBlock = cache_alloc(appSize);
+    } else{
+        arena_lock_home();
+        availBlock = heap_alloc(appSize);
+        arena_unlock();
+    }
+#else
+    availBlock = heap_alloc(appSize);
+#endif
+#ifdef UMALLOC_CHECK_FREE
+    if(availBlock != NULL){
+        shadow_mark(get_payload(availBlock));
+    }
+#endif
+    return availBlock;
+}
+
+/*
+ * payload_alloc - allocates size bytes from a slab or a block, all of umalloc outside hardened mode
+ */
+static void *payload_alloc(size_t size) {
+#ifndef UMALLOC_THREADS
+    //small requests are served from slabs while there is room for them
+    if(size <= SLAB_LIMIT){
+        void* object = slab_alloc(ALIGN(size));
+        if(object != NULL){
+            return object;
+        }
+    }
+#endif
+
+    memory_block_t* availBlock = alloc_block(get_request_size(size));
+    if(availBlock == NULL){
+        return NULL;
+    }
+    set_zeroed(availBlock, false);
+
+    //returns payload address to user
+    return get_payload(availBlock);  
+}
+
+/*
+ * payload_free - gives a payload from payload_alloc back to its slab, mapping or arena
+ */
+static void payload_free(void *ptr) {
+#ifdef UMALLOC_CHECK_FREE
+    //an invalid or second free is dropped instead of corrupting the heap
+    if(!check_payload(ptr, true)){
+        return;
+    }
+#endif
+
+#ifndef UMALLOC_THREADS
+    //special case: object from a slab, it has no header
+    if(is_slab_object(ptr)){
+        slab_free(ptr);
+        return;
+    }
+#endif
+
+    //get block address first
+    memory_block_t* curHeader = get_block(ptr);
+
+    //special case: block has a mapping of its own
+    if(is_mmapped(curHeader)){
+        mmap_free(curHeader);
+        return;
+    }
+
+#ifdef UMALLOC_THREADS
+    //small blocks go back to the cache that handed them out, through its remote list when that is
+    //another thread's, others go straight back to their arena
+    if(get_size(curHeader) <= CACHE_LIMIT){
+        size_t owner = get_owner(curHeader);
+        if(owner != 0 && owner != thread_cache.owner){
+            remote_free(curHeader, owner);
+        } else{
+            cache_free(curHeader);
+        }
+    } else{
+        arena_lock(get_arena(curHeader));
+        heap_free(curHeader);
+        arena_unlock();
+    }
+#else
+    heap_free(curHeader);
+#endif
     return;
-}
\ No newline at end of file
+}
+
+#ifdef UMALLOC_HARDEN
+/*
+ * In hardened mode payload_alloc hands out GUARD_OVERHEAD bytes more than asked for. The 16 bytes
+ * in front of the payload hold the requested size and a front guard, a rear guard follows its last
+ * byte. The guards are GUARD_WORD mixed with the payload address, so a guard copied from another
+ * payload fails, and the front guard also with the size. ufree checks both guards, fills the payload
+ * with POISON_BYTE, flips the front guard to mark it freed and parks it in the quarantine. Only the
+ * payloads the full quarantine pushes out go back to payload_free, after their guards and poison pass
+ * again, so a write through a dangling pointer while a payload is held back is caught before its
+ * memory is handed out again. A second free finds the flipped guard. Any corruption found aborts.
+ * Payloads with a mapping of their own skip the quarantine, once unmapped any access faults.
+ * urealloc keeps resizing in place, writing the guards again around the resized payload.
+ */
+
+/*
+ * harden_fail - reports a corrupted payload and stops, nothing after it can be trusted
+ */
+static void harden_fail(const char *error, void *payload) {
+    fprintf(stderr, "umalloc: %s at %p\n", error, payload);
+    abort();
+}
+
+/*
+ * get_guard - returns the rear guard of a payload, its front guard is this mixed with the size
+ */
+static size_t get_guard(char *payload) {
+    return GUARD_WORD ^ (uintptr_t) payload;
+}
+
+/*
+ * guard_payload - frames the payload of raw, a payload_alloc of size + GUARD_OVERHEAD bytes, with
+ * guards for size bytes. Returns the framed payload, or NULL when raw is NULL.
+ */
+static void *guard_payload(char *raw, size_t size) {
+    if(raw == NULL){
+        return NULL;
+    }
+    char* payload = raw + ALIGNMENT;
+    size_t guard = get_guard(payload);
+    ((size_t*) raw)[0] = size;
+    ((size_t*) raw)[1] = guard ^ size;
+    memcpy(payload + size, &guard, sizeof(size_t));
+    return payload;
+}
+
+/*
+ * check_guards - checks the guards of a payload, freed tells whether it should be in the quarantine.
+ * Returns its requested size.
+ */
+static size_t check_guards(char *payload, bool freed) {
+    size_t* front = (size_t*) (payload - ALIGNMENT);
+    size_t guard = get_guard(payload);
+    size_t frontGuard = freed ? ~front[1] : front[1];
+    if(frontGuard != (guard ^ front[0])){
+        harden_fail(!freed && ~frontGuard == (guard ^ front[0]) ? "double free" : "front guard overwritten", payload);
+    }
+
+    //the rear guard may not be aligned
+    size_t rearGuard;
+    memcpy(&rearGuard, payload + front[0], sizeof(size_t));
+    if(rearGuard != guard){
+        harden_fail("rear guard overwritten", payload);
+    }
+    return front[0];
+}
+
+/*
+ * quarantine_release - takes the oldest payload out of the quarantine and gives it back for
+ * reuse once its guards and poison pass
+ */
+static void quarantine_release() {
+    char* payload = quarantine[quarantine_head];
+    quarantine_head = (quarantine_head + 1) % QUARANTINE_SIZE;
+    quarantine_count--;
+    size_t size = check_guards(payload, true);
+    quarantine_bytes -= size;
+
+    //every poisoned byte equals the first and the first is poison, without a loop over the bytes
+    size_t poisoned = size < POISON_LIMIT ? size : POISON_LIMIT;
+    if(payload[0] != (char) POISON_BYTE || memcmp(payload, payload + 1, poisoned - 1) != 0){
+        harden_fail("freed payload written to", payload);
+    }
+    payload_free(payload - ALIGNMENT);
+}
+
+/*
+ * harden_free - checks and poisons a payload and parks it in the quarantine, first giving
+ * back the oldest payloads until it fits in QUARANTINE_SIZE payloads and QUARANTINE_BYTES.
+ * A mapped payload is given back right away.
+ */
+static void harden_free(char *payload) {
+#ifdef UMALLOC_CHECK_FREE
+    //the guards are only read once the pointer is known to be a live payload
+    if(!check_payload(payload - ALIGNMENT, false)){
+        return;
+    }
+#endif
+    size_t size = check_guards(payload, false);
+
+    //a payload with a mapping of its own is unmapped, any later access faults without poison
+#ifndef UMALLOC_THREADS
+    if(!is_slab_object(payload) && is_mmapped(get_block(payload - ALIGNMENT))){
+#else
+    if(is_mmapped(get_block(payload - ALIGNMENT))){
+#endif
+        payload_free(payload - ALIGNMENT);
+        return;
+    }
+    memset(payload, POISON_BYTE, size < POISON_LIMIT ? size : POISON_LIMIT);
+    ((size_t*) (payload - ALIGNMENT))[1] ^= ~(size_t) 0;
+
+#ifdef UMALLOC_THREADS
+    pthread_mutex_lock(&quarantine_lock);
+#endif
+    while(quarantine_count == QUARANTINE_SIZE || (quarantine_count > 0 && quarantine_bytes + size > QUARANTINE_BYTES)){
+        quarantine_release();
+    }
+    quarantine[(quarantine_head + quarantine_count) % QUARANTINE_SIZE] = payload;
+    quarantine_count++;
+    quarantine_bytes += size;
+#ifdef UMALLOC_THREADS
+    pthread_mutex_unlock(&quarantine_lock);
+#endif
+}
+#endif
+
+/*
+ * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ */
+void *umalloc(size_t size) {
+    //pre-condition where size must be greater than 0
+    assert(size > 0);
+
+    //special case: a size this big would wrap once headers are added
+    if(size > MAX_REQUEST){
+        return NULL;
+    }
+
+#ifdef UMALLOC_HARDEN
+    return guard_payload(payload_alloc(size + GUARD_OVERHEAD), size);
+#else
+    return payload_alloc(size);
+#endif
+}
+
+/*
+ * ufree -  frees the memory payload space pointed to by ptr, which must have been called
+ * by a previous call to malloc. 
+ */
+void ufree(void *ptr) {
+    //pre-condition: ptr cannot be NULL
+    assert(ptr != NULL);
+
+#ifdef UMALLOC_HARDEN
+    harden_free(ptr);
+#else
+    payload_free(ptr);
+#endif
+}
+
+/*
+ * resize_in_place - resizes a payload from payload_alloc to size bytes without copying it elsewhere,
+ * when its slab object is big enough, its mapping can be kept or resized by the kernel, or the heap
+ * around its block allows it. Returns the resized payload, or NULL when it has to be moved.
+ */
+static void *resize_in_place(void *ptr, size_t size) {
+#ifndef UMALLOC_THREADS
+    //slab objects stay put while the request still fits
+    if(is_slab_object(ptr)){
+        return size <= get_slab(ptr)->object_size ? ptr : NULL;
+    }
+#endif
+
+    memory_block_t* curHeader = get_block(ptr);
+    size_t appSize = get_request_size(size);
+
+    //mmapped blocks stay mmapped while the request is still large, keeping their mapping
+    //while the request fits and else having it resized by the kernel
+    if(is_mmapped(curHeader)){
+        if(appSize > mmap_threshold && size <= get_payload_size(curHeader)){
+            return ptr;
+        }
+        if(appSize > mmap_threshold){
+            memory_block_t* resized = mmap_resize(curHeader, appSize);
+            if(resized != NULL){
+                return get_payload(resized);
+            }
+        }
+
+    //else tries to resize in place, as long as the block stays small enough for the heap
+    } else if(appSize <= mmap_threshold){
+#ifdef UMALLOC_THREADS
+        arena_lock(get_arena(curHeader));
+        memory_block_t* resized = heap_resize(curHeader, appSize);
+        arena_unlock();
+#else
+        memory_block_t* resized = heap_resize(curHeader, appSize);
+#endif
+#ifdef UMALLOC_CHECK_FREE
+        //sliding down into the prev neighbor moves the payload
+        if(resized != NULL && resized != curHeader){
+            shadow_clear(shadow_granule(ptr));
+            shadow_mark(get_payload(resized));
+        }
+#endif
+        if(resized != NULL){
+            return get_payload(resized);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * urealloc - changes the size of the payload pointed to by ptr to size bytes, keeping its
+ * contents up to the smaller of the two sizes. Resizes in place when the heap around the block
+ * allows it, else moves the payload to a new block. A NULL ptr behaves like umalloc, a size
+ * of 0 like ufree.
+ */
+void *urealloc(void *ptr, size_t size) {
+    //special cases: nothing to resize or nothing to keep
+    if(ptr == NULL){
+        return umalloc(size);
+    }
+    if(size == 0){
+        ufree(ptr);
+        return NULL;
+    }
+
+    //special case: a size this big would wrap once headers are added, ptr is kept as is
+    if(size > MAX_REQUEST){
+        return NULL;
+    }
+
+#ifdef UMALLOC_HARDEN
+#ifdef UMALLOC_CHECK_FREE
+    if(!check_payload((char*) ptr - ALIGNMENT, false)){
+        return NULL;
+    }
+#endif
+    //the guards are written again around the resized payload
+    size_t oldPayloadSize = check_guards(ptr, false);
+    char* resized = resize_in_place((char*) ptr - ALIGNMENT, size + GUARD_OVERHEAD);
+    if(resized != NULL){
+        return guard_payload(resized, size);
+    }
+#else
+#ifdef UMALLOC_CHECK_FREE
+    //a pointer that is not a payload is left alone and the resize fails
+    if(!check_payload(ptr, false)){
+        return NULL;
+    }
+#endif
+    void* resized = resize_in_place(ptr, size);
+    if(resized != NULL){
+        return resized;
+    }
+#ifndef UMALLOC_THREADS
+    size_t oldPayloadSize = is_slab_object(ptr) ? get_slab(ptr)->object_size : get_payload_size(get_block(ptr));
+#else
+    size_t oldPayloadSize = get_payload_size(get_block(ptr));
+#endif
+#endif
+
+    //else copies the payload over to a new block
+    void* newPayload = umalloc(size);
+    if(newPayload == NULL){
+        return NULL;
+    }
+    memcpy(newPayload, ptr, oldPayloadSize < size ? oldPayloadSize : size);
+    ufree(ptr);
+    return newPayload;
+}
+
+/*
+ * ucalloc - allocates an array of nmemb elements of size bytes each, with every byte set
+ * to zero. Returns NULL if the total size overflows or is 0. Blocks carved from memory fresh
+ * from csbrk only need the words the free list kept in them cleared, recycled blocks are
+ * cleared in full.
+ */
+void *ucalloc(size_t nmemb, size_t size) {
+    //special case: empty or overflowing request, the total must also leave room for headers
+    if(nmemb == 0 || size == 0 || nmemb > MAX_REQUEST / size){
+        return NULL;
+    }
+    size_t totalSize = nmemb * size;
+
+#ifdef UMALLOC_HARDEN
+    //the guards take the front of the block, the known zero words are not where the payload starts
+    void* guarded = umalloc(totalSize);
+    if(guarded != NULL){
+        memset(guarded, 0, totalSize);
+    }
+    return guarded;
+#else
+#ifndef UMALLOC_THREADS
+    //slab objects may have been used before
+    if(totalSize <= SLAB_LIMIT){
+        void* object = slab_alloc(ALIGN(totalSize));
+        if(object != NULL){
+            memset(object, 0, totalSize);
+            return object;
+        }
+    }
+#endif
+
+    memory_block_t* availBlock = alloc_block(get_request_size(totalSize));
+    if(availBlock == NULL){
+        return NULL;
+    }
+    void* payload = get_payload(availBlock);
+
+    //mmapped blocks are all zero, known zero blocks only hold the old links at the front
+    //and the old footer at the end
+    if(is_mmapped(availBlock)){
+        set_zeroed(availBlock, false);
+    } else if(is_zeroed(availBlock)){
+        availBlock->next = NULL;
+        availBlock->prev = NULL;
+        *get_footer(availBlock) = 0;
+        set_zeroed(availBlock, false);
+    } else{
+        memset(payload, 0, totalSize);
+    }
+    return payload;
+#endif
+}
+
+#ifndef UMALLOC_NO_STATS
+/*
+ * stats_add_free - counts a free heap block of size bytes in stats, heapFree sums the
+ * free heap bytes the fragmentation index is taken over
+ */
+static void stats_add_free(umalloc_stats_t *stats, size_t size, size_t *heapFree) {
+    stats->free_blocks[get_class(size)]++;
+    stats->largest_free = size > stats->largest_free ? size : stats->largest_free;
+    *heapFree += size;
+}
+
+#ifdef UMALLOC_BEST_FIT
+/*
+ * stats_add_tree - counts every free block of a subtree of the best fit tree in stats
+ */
+static void stats_add_tree(umalloc_stats_t *stats, memory_block_t *node, size_t *heapFree) {
+    if(node == NULL){
+        return;
+    }
+    for(memory_block_t* cur = node; cur != NULL; cur = cur->next){
+        stats_add_free(stats, get_size(cur), heapFree);
+    }
+    stats_add_tree(stats, get_node(node)->left, heapFree);
+    stats_add_tree(stats, get_node(node)->right, heapFree);
+}
+#endif
+
+/*
+ * umalloc_stats - fills in stats with the counters kept since uinit and what a walk of the
+ * free lists finds. The walk is the only cost, the counters are single adds on the paths
+ * that split, merge or get memory. In thread safe mode each arena is locked while it is walked.
+ */
+void umalloc_stats(umalloc_stats_t *stats) {
+    memset(stats, 0, sizeof(umalloc_stats_t));
+    size_t heapFree = 0;
+
+    for(size_t id = 0; id < NUM_ARENAS; id++){
+        arena_t* curArena = &arenas[id];
+#ifdef UMALLOC_THREADS
+        pthread_mutex_lock(&curArena->lock);
+#endif
+        stats->bytes_held += curArena->held_bytes;
+        stats->splits += curArena->splits;
+        stats->coalesces += curArena->coalesces;
+        for(size_t i = 0; i < NUM_CLASSES; i++){
+            for(memory_block_t* cur = curArena->free_lists[i]; cur != NULL; cur = cur->next){
+                stats_add_free(stats, get_size(cur), &heapFree);
+            }
+        }
+#ifdef UMALLOC_BEST_FIT
+        stats_add_tree(stats, curArena->free_tree, &heapFree);
+#endif
+#ifdef UMALLOC_DEFER_COALESCE
+        for(size_t i = 0; i < NUM_SMALL_CLASSES; i++){
+            for(memory_block_t* cur = curArena->quick_lists[i]; cur != NULL; cur = cur->next){
+                stats_add_free(stats, get_size(cur), &heapFree);
+            }
+        }
+#endif
+#ifdef UMALLOC_THREADS
+        pthread_mutex_unlock(&curArena->lock);
+#endif
+    }
+    stats->csbrk_calls = stat_csbrk_calls;
+    stats->bytes_held += __atomic_load_n(&stat_mmap_bytes, __ATOMIC_RELAXED);
+    stats->bytes_free = heapFree;
+
+#ifndef UMALLOC_THREADS
+    //slab pages count as held once committed, their free objects as free
+    if(slab_base != NULL){
+        stats->bytes_held += slab_committed - slab_base;
+        stats->bytes_free += slab_committed - slab_top;
+        for(slab_t* slab = empty_slabs; slab != NULL; slab = slab->next){
+            stats->bytes_free += SLAB_SIZE;
+        }
+        for(size_t i = 0; i < NUM_SLAB_CLASSES; i++){
+            for(slab_t* slab = partial_slabs[i]; slab != NULL; slab = slab->next){
+                stats->bytes_free += (size_t) slab->num_free * slab->object_size;
+            }
+        }
+    }
+#endif
+
+    stats->bytes_in_use = stats->bytes_held - stats->bytes_free;
+    stats->fragmentation = heapFree ? 1.0 - (double) stats->largest_free / heapFree : 0;
+}
+#endif
@@ -1,47 +1,240 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#ifdef UMALLOC_THREADS
+#include <pthread.h>
+#endif
 
 #define ALIGNMENT 16 /* The alignment of all payloads returned by umalloc */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
+#define PREV_FREE 0x2 /* Header bit set when the physically previous block is free */
+#define ZEROED 0x4 /* Header bit set when the payload is known to be zero */
+#define MMAPPED 0x8 /* Header bit set when the block has a mapping of its own */
+#define OWNER_SHIFT 48 /* Header bits 48 to 55 name the thread cache a block was handed out by */
+#define ARENA_SHIFT 56 /* Header bits 56 to 63 name the arena an allocated block belongs to */
+#define SIZE_MASK (((size_t) 1 << OWNER_SHIFT) - ALIGNMENT) /* Header bits holding the block size */
+#define MMAP_THRESHOLD (32 * 1024) /* Default block size above which requests are mmapped */
+#define TRIM_THRESHOLD (128 * 1024) /* Free block size at which memory is given back to the OS */
+#define NUM_CLASSES 64 /* Number of segregated size classes, one bit each in free_bitmap */
+#define SMALL_CLASS_LIMIT 512 /* Largest block size with its own 16 byte wide class */
+#define NUM_SMALL_CLASSES (SMALL_CLASS_LIMIT / ALIGNMENT) /* Classes below the power of two classes */
+#define HEADER_SIZE sizeof(size_t) /* Only block_size_alloc sits in front of a payload */
+#define REGION_OVERHEAD (2 * HEADER_SIZE) /* Alignment pad at the start of a region plus its epilogue */
+#define MIN_BLOCK_SIZE ALIGN(sizeof(memory_block_t) + sizeof(size_t)) /* Header, links and footer */
+#define MAX_REQUEST PTRDIFF_MAX /* Largest size umalloc accepts, headers can be added to it without wrapping */
+
 /*
  * memory_block_t - Represents a block of memory managed by the heap. The 
  * struct can be left as is, or modified for your design.
  * In the current design bit0 is the allocated bit
- * bits 1-3 are unused.
- * and the remaining 60 bit represent the size.
+ * bit1 is set when the block physically before this one is free,
+ * bit2 is set when the payload is known to be zero (memory fresh from csbrk),
+ * bit3 is set when the block lives in a mapping of its own, its size is then
+ * the length of the mapping.
+ * bits 4 to 47 represent the size, in thread safe mode bits 48 to 55 hold
+ * the owner id of the thread cache that handed out an allocated block
+ * and bits 56 to 63 the id of the arena it was allocated from.
+ * Only block_size_alloc is a real header, prev and next overlay the first
+ * 16 bytes of the payload and are only valid while the block is free.
+ * Free blocks also repeat their size in a footer in their last 8 bytes.
  */
 typedef struct memory_block_struct {
-    //header size is 32 bytes
+    //header size is 8 bytes
     size_t block_size_alloc;
 
-    //extra field is used for padding to make 
-    //struct size 16 byte aligned
-    size_t padding;
-
-    //pointers for prev and next blocks
+    //pointers for prev and next blocks, stored in the payload of free blocks
     struct memory_block_struct *prev;
     struct memory_block_struct *next;
-    
 
 } memory_block_t;
 
+#ifdef UMALLOC_BEST_FIT
+/*
+ * tree_node_t - Overlay of a free block bigger than SMALL_CLASS_LIMIT in best fit mode.
+ * Such blocks are kept in a splay tree keyed by size instead of the power of two classes.
+ * The first block of each size is the tree node, blocks of the same size hang off it in a
+ * list through next and prev, a block in that list always has a prev.
+ */
+typedef struct {
+    memory_block_t block;
+    memory_block_t *left;
+    memory_block_t *right;
+} tree_node_t;
+#endif
+
+#ifdef UMALLOC_THREADS
+#define NUM_ARENAS 8 /* Independent heaps threads are spread over */
+#else
+#define NUM_ARENAS 1
+#endif
+
+#ifdef UMALLOC_DEFER_COALESCE
+#define QUICK_LIMIT SMALL_CLASS_LIMIT /* Largest block size freed to a quick list */
+#define QUICK_MAX 128 /* Blocks the quick lists hold before they are merged into the heap */
+#endif
+
+/*
+ * arena_t - An independent heap: its own free lists and its own regions from csbrk, the
+ * newest of which ends in heap_end. In thread safe mode each arena has its own lock.
+ */
+typedef struct {
+    //Heads of the segregated free lists, one per size class
+    memory_block_t *free_lists[NUM_CLASSES];
+
+    //Bit i is set when free_lists[i] is non-empty
+    uint64_t free_bitmap;
+
+    //Epilogue of the most recently extended heap region
+    memory_block_t *heap_end;
+
+#ifdef UMALLOC_BEST_FIT
+    //Root of the splay tree of free blocks bigger than SMALL_CLASS_LIMIT
+    memory_block_t *free_tree;
+#endif
+
+#ifdef UMALLOC_DEFER_COALESCE
+    //Recently freed small blocks, one list per small size class, and how many blocks they hold in total
+    memory_block_t *quick_lists[NUM_SMALL_CLASSES];
+    size_t quick_count;
+#endif
+
+#ifdef UMALLOC_THREADS
+    pthread_mutex_t lock;
+#endif
+    size_t id;
+
+#ifndef UMALLOC_NO_STATS
+    //Bytes of the arena's regions, and how many blocks it split and merged since uinit
+    size_t held_bytes;
+    size_t splits;
+    size_t coalesces;
+#endif
+} arena_t;
+
+#ifndef UMALLOC_NO_STATS
+/*
+ * umalloc_stats_t - Snapshot of the heap filled in by umalloc_stats. Blocks in quick
+ * lists count as free, blocks in thread caches as in use. Build with -DUMALLOC_NO_STATS
+ * to drop the counters and umalloc_stats altogether.
+ */
+typedef struct {
+    size_t bytes_held;               /* Bytes held from csbrk, mmap and the slab range */
+    size_t bytes_in_use;             /* Bytes held that are not free, headers included */
+    size_t bytes_free;               /* Bytes in free heap blocks and free slab objects */
+    size_t free_blocks[NUM_CLASSES]; /* Free heap blocks in each size class */
+    size_t largest_free;             /* Size of the largest free heap block */
+    size_t csbrk_calls;              /* Calls to csbrk since uinit, growing or trimming */
+    size_t splits;                   /* Free blocks split to serve a request */
+    size_t coalesces;                /* Merges of a free block with a free neighbor */
+    double fragmentation;            /* 1 - largest free block / free heap bytes, 0 when none is free */
+} umalloc_stats_t;
+#endif
+
+#ifndef UMALLOC_THREADS
+#define SLAB_LIMIT 256 /* Largest request served from a slab */
+#define NUM_SLAB_CLASSES (SLAB_LIMIT / ALIGNMENT) /* One slab class per 16 bytes of request size */
+#define SLAB_SIZE 4096 /* Bytes per slab, slabs are aligned to their size */
+#define SLAB_RESERVE (64 * 1024 * 1024) /* Address space reserved for slabs */
+#define SLAB_WARMUP 128 /* Requests a slab class sees from the heap before it gets slabs */
+#define SLAB_MAP_WORDS 4 /* Words of free bitmap, enough for the objects of the smallest class */
+#define SLAB_HEADER_SIZE ALIGN(sizeof(slab_t)) /* Bytes in front of the first object of a slab */
+
+/*
+ * slab_t - Header at the start of a slab, a page of equally sized objects without
+ * headers of their own. The slab of an object is found by rounding its address down
+ * to SLAB_SIZE. Bit i of free_map is set while object i is free.
+ */
+typedef struct slab_struct {
+    //links in the list of partial slabs of its class, next alone links empty slabs
+    struct slab_struct *prev;
+    struct slab_struct *next;
+
+    uint64_t free_map[SLAB_MAP_WORDS];
+    uint32_t object_size;
+    uint32_t num_free;
+} slab_t;
+#endif
+
+#ifdef UMALLOC_THREADS
+#define CACHE_LIMIT SMALL_CLASS_LIMIT /* Largest block size kept in a thread cache */
+#define CACHE_BIN_MAX 32 /* Blocks a cache bin holds before half of it is flushed */
+#define CACHE_REFILL 8 /* Blocks taken from the arena when a cache bin is empty */
+#define MAX_OWNERS 256 /* Owner ids of thread caches, id 0 means a block has no owner */
+
+/*
+ * thread_cache_t - Per-thread cache of small allocated blocks, one singly linked
+ * bin (through next) per small size class. owner is the id the cache stamps into
+ * the blocks it hands out, other threads freeing them push them on its remote list.
+ */
+typedef struct {
+    memory_block_t *bins[NUM_SMALL_CLASSES];
+    unsigned counts[NUM_SMALL_CLASSES];
+    size_t owner;
+    bool registered;
+} thread_cache_t;
+#endif
+
+#ifdef UMALLOC_CHECK_FREE
+#define SHADOW_SPAN ((size_t) 1 << 36) /* Bytes above the initial break the shadow bitmap of payloads covers */
+#endif
+
+#ifdef UMALLOC_HARDEN
+#define GUARD_WORD 0x5afec0de5afec0deUL /* Guard word before and after a payload, mixed with its address */
+#define GUARD_OVERHEAD (ALIGNMENT + sizeof(size_t)) /* Requested size and front guard before a payload, rear guard after */
+#define POISON_BYTE 0xdb /* Fill of a freed payload while it sits in the quarantine */
+#define POISON_LIMIT 256 /* Most bytes poisoned at the front of a freed payload */
+#define QUARANTINE_SIZE 16 /* Most freed payloads held back before they are given back for reuse */
+#define QUARANTINE_BYTES (64 * 1024) /* Most payload bytes held back, a bigger payload is held back alone */
+#endif
+
 // Helper Functions, this may be editted if you change the signature in umalloc.c
 bool is_allocated(memory_block_t *block);
 void allocate(memory_block_t *block);
 void deallocate(memory_block_t *block);
 size_t get_size(memory_block_t *block);
+void set_size(memory_block_t *block, size_t size);
+bool is_prev_free(memory_block_t *block);
+void set_prev_free(memory_block_t *block, bool prev_free);
+bool is_zeroed(memory_block_t *block);
+void set_zeroed(memory_block_t *block, bool zeroed);
+bool is_mmapped(memory_block_t *block);
+size_t get_payload_size(memory_block_t *block);
 void put_block(memory_block_t *block, size_t size, bool alloc);
 void *get_payload(memory_block_t *block);
 memory_block_t *get_block(void *payload);
+size_t get_class(size_t size);
+memory_block_t *get_next(memory_block_t *block);
+memory_block_t *get_prev(memory_block_t *block);
+size_t *get_footer(memory_block_t *block);
+
+size_t get_request_size(size_t size);
+memory_block_t *heap_alloc(size_t appSize);
+void heap_free(memory_block_t *block);
+void release(memory_block_t *block, char *newStart, char *newEnd);
+memory_block_t *alloc_block(size_t appSize);
+memory_block_t *mmap_alloc(size_t appSize);
+void mmap_free(memory_block_t *block);
+memory_block_t *mmap_resize(memory_block_t *block, size_t appSize);
+void shrink_block(memory_block_t *block, size_t appSize);
+memory_block_t *heap_resize(memory_block_t *block, size_t appSize);
 
 memory_block_t *find(size_t size);
 memory_block_t *extend(size_t size);
-memory_block_t *split(memory_block_t *block, size_t size);
-void coalesce(memory_block_t *block);
+memory_block_t *split(memory_block_t *block, size_t size, bool front);
+memory_block_t *coalesce(memory_block_t *block);
+void consolidate();
 
 
 // Portion that may not be edited
 int uinit();
 void *umalloc(size_t size);
-void ufree(void *ptr);
\ No newline at end of file
+void ufree(void *ptr);
+
+// Extensions to the umalloc interface
+void *urealloc(void *ptr, size_t size);
+void *ucalloc(size_t nmemb, size_t size);
+void uset_mmap_threshold(size_t threshold);
+#ifndef UMALLOC_NO_STATS
+void umalloc_stats(umalloc_stats_t *stats);
+#endif
\ No newline at end of file